@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+
+#include "filter.h"
+#include "monitor.h"
+#include "updater.h"
+#include "util.h"
+
+#define N_MESSAGES 4096
+#define ROUNDS 256
+#define MAX_MESSAGE_LEN 128
+
+// Synthetic traffic through the same path as the netlink socket, bar the BPF filter
+struct Scenario {
+	char const * name;
+	// Monitored interfaces are 1..n_monitored, messages are spread over 1..n_ifaces
+	unsigned int n_monitored;
+	unsigned int n_ifaces;
+	// Percentages
+	unsigned int ipv6;
+	unsigned int deladdr;
+	unsigned int link_scope;
+	unsigned int temporary;
+	unsigned int deprecated;
+	unsigned int private;
+};
+
+static struct Scenario const scenarios[] = {
+	{"edge router", 4, 8, 60, 20, 20, 10, 5, 30},
+	{"container host", 4, 4000, 50, 45, 40, 0, 0, 80},
+	{"dual-stack uplinks", 64, 64, 70, 10, 10, 20, 10, 10},
+};
+
+struct Message {
+	size_t len;
+	char buf[MAX_MESSAGE_LEN];
+};
+
+static unsigned int percent(unsigned int p) {
+	return (unsigned int) (random() % 100) < p;
+}
+
+static size_t buildMessage(struct Scenario const * scenario, char * buf) {
+	memset(buf, 0, MAX_MESSAGE_LEN);
+	struct nlmsghdr * nlh = (struct nlmsghdr *) buf;
+	struct ifaddrmsg * ifa = NLMSG_DATA(nlh);
+
+	nlh->nlmsg_type = percent(scenario->deladdr) ? RTM_DELADDR : RTM_NEWADDR;
+	ifa->ifa_family = percent(scenario->ipv6) ? AF_INET6 : AF_INET;
+	ifa->ifa_index = 1 + random() % scenario->n_ifaces;
+	ifa->ifa_scope = percent(scenario->link_scope) ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE;
+	ifa->ifa_prefixlen = ifa->ifa_family == AF_INET6 ? 64 : 24;
+	uint32_t flags = (percent(scenario->temporary) ? IFA_F_TEMPORARY : 0)
+		| (percent(scenario->deprecated) ? IFA_F_DEPRECATED : 0);
+	ifa->ifa_flags = flags;
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifa));
+
+	struct rtattr * rta = (struct rtattr *) (buf + NLMSG_ALIGN(nlh->nlmsg_len));
+	unsigned char * addr = RTA_DATA(rta);
+	rta->rta_type = IFA_ADDRESS;
+	if (ifa->ifa_family == AF_INET6) {
+		rta->rta_len = RTA_LENGTH(16);
+		addr[0] = percent(scenario->private) ? 0xFD : 0x20;
+		addr[1] = 0x01;
+		// A handful of addresses per interface, so some are repeats
+		addr[14] = ifa->ifa_index;
+		addr[15] = random() % 4;
+	} else {
+		rta->rta_len = RTA_LENGTH(4);
+		addr[0] = percent(scenario->private) ? 10 : 198;
+		addr[1] = 51;
+		addr[2] = ifa->ifa_index;
+		addr[3] = random() % 4;
+	}
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+	rta = (struct rtattr *) (buf + nlh->nlmsg_len);
+	rta->rta_type = IFA_FLAGS;
+	rta->rta_len = RTA_LENGTH(sizeof(flags));
+	memcpy(RTA_DATA(rta), &flags, sizeof(flags));
+	nlh->nlmsg_len += RTA_ALIGN(rta->rta_len);
+
+	return nlh->nlmsg_len;
+}
+
+static double elapsedNs(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+static void report(FILE * out, char const * scenario, char const * stage, double ns, size_t n, size_t accepted) {
+	fprintf(out, "%-20s %-16s %12.0f msg/s %8.1f ns/msg %6.2f%% accepted\n",
+	        scenario, stage, n / ns * 1e9, ns / n, 100.0 * accepted / n);
+}
+
+static int runScenario(FILE * out, struct Scenario const * scenario, struct Message * messages) {
+	srandom(1);
+	for (size_t i = 0; i < N_MESSAGES; i++) {
+		messages[i].len = buildMessage(scenario, messages[i].buf);
+	}
+
+	struct AddrFilter filter = {.ipv4 = true, .ipv6 = true};
+	for (unsigned int iface = 1; iface <= scenario->n_monitored; iface++) {
+		if (filterAddIface(&filter, 0, iface) < 0) return -1;
+	}
+
+	// Filter alone, no syscalls
+	struct timespec start, end;
+	size_t accepted = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t round = 0; round < ROUNDS; round++) {
+		for (size_t i = 0; i < N_MESSAGES; i++) {
+			struct nlmsghdr const * nlh = (struct nlmsghdr const *) messages[i].buf;
+			struct FilterResult result;
+			if (filterMessage(&filter, 0, nlh, &result)) accepted++;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report(out, scenario->name, "filterMessage", elapsedNs(start, end), ROUNDS * N_MESSAGES, accepted);
+
+	// Whole receive path, one datagram per message as with notifications
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) return -1;
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds) == -1) return -1;
+	Updater_t updater = createPrintUpdater((struct PrintUpdaterOptions) {.fd = STDOUT_FILENO});
+	// No netlink socket of its own, the socketpair is added instead
+	Monitor_t monitor = createMonitor(filter, 1024, epoll_fd, updater, (struct MonitorOptions) {.replay = true});
+	if (monitor == NULL || addMonitorSocket(monitor, fds[1], 0) != 0) return -1;
+
+	double ns = 0;
+	for (size_t round = 0; round < ROUNDS; round++) {
+		for (size_t i = 0; i < N_MESSAGES;) {
+			// Queue as much as the socket takes, then time draining it
+			size_t queued = i;
+			while (i < N_MESSAGES && send(fds[0], messages[i].buf, messages[i].len, 0) != -1) i++;
+			if (i == queued && errno != EAGAIN) return -1;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if (processMessage(monitor, fds[1], EPOLLIN) != 0) return -1;
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			ns += elapsedNs(start, end);
+		}
+	}
+	struct MonitorStats stats = monitorStats(monitor);
+	report(out, scenario->name, "processMessage", ns, ROUNDS * N_MESSAGES, stats.delivered - stats.rejected);
+
+	destroyMonitor(monitor);
+	destroyUpdater(updater);
+	close(fds[0]);
+	close(epoll_fd);
+	return 0;
+}
+
+int main(void) {
+	// Addresses go to the print updater, keep them out of the results
+	FILE * out = fdopen(dup(STDOUT_FILENO), "w");
+	if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+		perror("Couldn't redirect stdout");
+		return EXIT_FAILURE;
+	}
+
+	struct Message * messages = malloc(N_MESSAGES * sizeof(*messages));
+	if (messages == NULL) return EXIT_FAILURE;
+
+	for (size_t i = 0; i < NELEMS(scenarios); i++) {
+		if (runScenario(out, &scenarios[i], messages) != 0) {
+			perror(scenarios[i].name);
+			return EXIT_FAILURE;
+		}
+	}
+
+	free(messages);
+	fclose(out);
+	return EXIT_SUCCESS;
+}
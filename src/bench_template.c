@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#ifndef HAVE_strlcpy
+#include "strlcpy.h"
+#define HAVE_strlcpy
+#endif
+
+#include "url_template.h"
+
+#define ITERATIONS 1000000
+
+// templateUrl() as it was before templates were pre-parsed, as a baseline
+static char const * const ip_tag = "<ipaddr>";
+
+static bool templateUrl(struct IPAddr address, char const * src, char * dst, size_t max_size){
+	const size_t tag_len = strlen(ip_tag);
+
+	char * write_pos = dst;
+	const char * read_pos = src;
+	const char * tag_pos = src;
+
+	while ((tag_pos = strstr(read_pos, ip_tag)) != NULL){
+		size_t copy_len = tag_pos - read_pos;
+		if (copy_len > max_size) {
+			errno = ENOSPC;
+			return false;
+		}
+		memcpy(write_pos, read_pos, copy_len);
+		write_pos += copy_len;
+		max_size -= copy_len;
+
+		if (inet_ntop(address.af, &address, write_pos, max_size) == NULL) {
+			return false;
+		}
+		size_t ip_len = strlen(write_pos);
+		write_pos += ip_len;
+		max_size -= ip_len;
+
+		read_pos = tag_pos + tag_len;
+	}
+
+	if (strlcpy(write_pos, read_pos, max_size) >= max_size){
+		errno = ENOSPC;
+		return false;
+	}
+
+	return true;
+}
+
+static double elapsedNs(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+static void report(char const * name, double ns, unsigned long checksum) {
+	printf("%-24s %8.1f ns/render (checksum %lu)\n", name, ns / ITERATIONS, checksum);
+}
+
+int main(void) {
+	char const * const src =
+		"https://dyn.example.com/nic/update?hostname=myhost.example.com&myip=<ipaddr>&offline=NO";
+	struct AddrEvent event = {.iface = "eth0"};
+	event.addr.af = AF_INET6;
+	inet_pton(AF_INET6, "2001:db8:1234:5678:9abc:def0:1234:5678", &event.addr.ipv6);
+	event.ipv6 = event.addr;
+
+	struct UrlTemplate tmpl;
+	if (parseTemplate(&tmpl, src, "myhost") != 0) {
+		perror("Couldn't parse template");
+		return EXIT_FAILURE;
+	}
+	char * url = malloc(tmpl.max_len);
+	if (url == NULL) return EXIT_FAILURE;
+
+	struct timespec start, end;
+	unsigned long checksum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		event.addr.ipv6.s6_addr[15] = i;
+		if (!templateUrl(event.addr, src, url, tmpl.max_len)) return EXIT_FAILURE;
+		checksum += url[70];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("templateUrl", elapsedNs(start, end), checksum);
+
+	checksum = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		event.addr.ipv6.s6_addr[15] = i;
+		if (!renderTemplate(&tmpl, &event, url, tmpl.max_len)) return EXIT_FAILURE;
+		checksum += url[70];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report("renderTemplate", elapsedNs(start, end), checksum);
+
+	free(url);
+	destroyTemplate(&tmpl);
+	return EXIT_SUCCESS;
+}
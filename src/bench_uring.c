@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+
+#include "filter.h"
+#include "monitor.h"
+#include "updater.h"
+#include "util.h"
+
+#define MAX_BURSTS 2000
+#define MAX_MESSAGE_LEN 64
+// Gap between bursts, so each finds the monitor asleep
+#define IDLE_NS 100000
+
+// Address storms of varying size through the epoll and io_uring receive paths, over a socketpair
+// standing in for netlink
+struct Storm {
+	size_t burst;
+	size_t n_bursts;
+};
+
+static struct Storm const storms[] = {
+	{1, 2000},
+	{32, 500},
+	{256, 100},
+};
+
+struct Producer {
+	int fd;
+	struct Storm storm;
+	// Bursts started, and when
+	atomic_size_t sent;
+	struct timespec stamps[MAX_BURSTS];
+	// Bursts fully processed by the monitor
+	atomic_size_t done;
+};
+
+static size_t buildMessage(size_t i, char * buf) {
+	memset(buf, 0, MAX_MESSAGE_LEN);
+	struct nlmsghdr * nlh = (struct nlmsghdr *) buf;
+	struct ifaddrmsg * ifa = NLMSG_DATA(nlh);
+	nlh->nlmsg_type = RTM_NEWADDR;
+	ifa->ifa_family = AF_INET;
+	ifa->ifa_index = 1;
+	ifa->ifa_prefixlen = 24;
+	ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifa));
+
+	struct rtattr * rta = (struct rtattr *) (buf + NLMSG_ALIGN(nlh->nlmsg_len));
+	unsigned char * addr = RTA_DATA(rta);
+	rta->rta_type = IFA_ADDRESS;
+	rta->rta_len = RTA_LENGTH(4);
+	// Flapping between two addresses, like a link going up and down
+	addr[0] = 198;
+	addr[1] = 51;
+	addr[2] = 100;
+	addr[3] = 1 + i % 2;
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return nlh->nlmsg_len;
+}
+
+static double elapsedNs(struct timespec start, struct timespec end) {
+	return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+static void * produce(void * arg) {
+	struct Producer * producer = arg;
+	char buf[MAX_MESSAGE_LEN];
+	struct timespec const idle = {.tv_nsec = IDLE_NS};
+	for (size_t b = 0; b < producer->storm.n_bursts; b++) {
+		nanosleep(&idle, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &producer->stamps[b]);
+		atomic_store(&producer->sent, b + 1);
+		for (size_t i = 0; i < producer->storm.burst; i++) {
+			size_t len = buildMessage(b * producer->storm.burst + i, buf);
+			if (send(producer->fd, buf, len, 0) == -1) {
+				perror("send");
+				exit(EXIT_FAILURE);
+			}
+		}
+		while (atomic_load(&producer->done) <= b) nanosleep(&idle, NULL);
+	}
+	return NULL;
+}
+
+static int compareDoubles(void const * a, void const * b) {
+	double const x = *(double const *) a, y = *(double const *) b;
+	return (x > y) - (x < y);
+}
+
+static int runStorm(FILE * out, struct Storm const * storm, bool io_uring, double * latencies) {
+	struct AddrFilter filter = {.ipv4 = true, .ipv6 = true};
+	if (filterAddIface(&filter, 0, 1) < 0) return -1;
+
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) return -1;
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1) return -1;
+	Updater_t updater = createPrintUpdater((struct PrintUpdaterOptions) {.fd = STDOUT_FILENO});
+	// No netlink socket of its own, the socketpair is added instead
+	Monitor_t monitor = createMonitor(filter, 1024, epoll_fd, updater,
+	                                  (struct MonitorOptions) {.replay = true, .io_uring = io_uring});
+	if (monitor == NULL || addMonitorSocket(monitor, fds[1], 0) != 0) return -1;
+
+	struct Producer * producer = calloc(1, sizeof(*producer));
+	if (producer == NULL) return -1;
+	producer->fd = fds[0];
+	producer->storm = *storm;
+	pthread_t thread;
+	if ((errno = pthread_create(&thread, NULL, produce, producer)) != 0) return -1;
+
+	// The event loop, as in dyndns, timing from the start of each burst to the first wakeup after it
+	unsigned long long waits = 0;
+	size_t seen = 0;
+	size_t const total = storm->burst * storm->n_bursts;
+	while (monitorStats(monitor).delivered < total) {
+		struct epoll_event events[16];
+		int nevents = epoll_wait(epoll_fd, events, NELEMS(events), -1);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		waits++;
+		if (nevents < 0 && errno != EINTR) return -1;
+		if (seen < atomic_load(&producer->sent)) {
+			latencies[seen] = elapsedNs(producer->stamps[seen], now);
+			seen++;
+		}
+
+		// io_uring posts completions by interrupting the wait, as in dyndns
+		if (nevents < 0 && io_uring && processUring(monitor, -1, 0) != 0) return -1;
+		for (int i = 0; i < nevents; i++) {
+			struct EpollData * data = events[i].data.ptr;
+			int result = data->tag == EPOLL_MONITOR_URING
+				? processUring(monitor, data->fd, events[i].events)
+				: processMessage(monitor, data->fd, events[i].events);
+			if (result != 0) return -1;
+		}
+		if (flushUpdater(updater) != 0) return -1;
+		size_t const done = monitorStats(monitor).delivered / storm->burst;
+		if (done > atomic_load(&producer->done)) atomic_store(&producer->done, done);
+	}
+	pthread_join(thread, NULL);
+
+	struct MonitorStats stats = monitorStats(monitor);
+	qsort(latencies, seen, sizeof(*latencies), compareDoubles);
+	fprintf(out, "%-8s %4zu msg/burst %8.3f epoll_wait/msg %8.3f receive syscalls/msg"
+	        " %8.1f us p50 wakeup %8.1f us p99 wakeup\n",
+	        io_uring ? "io_uring" : "epoll", storm->burst, (double) waits / total, (double) stats.syscalls / total,
+	        latencies[seen / 2] / 1000, latencies[seen * 99 / 100] / 1000);
+
+	free(producer);
+	destroyMonitor(monitor);
+	destroyUpdater(updater);
+	close(fds[0]);
+	close(epoll_fd);
+	return 0;
+}
+
+int main(void) {
+	// Addresses go to the print updater, keep them out of the results
+	FILE * out = fdopen(dup(STDOUT_FILENO), "w");
+	if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+		perror("Couldn't redirect stdout");
+		return EXIT_FAILURE;
+	}
+
+	double * latencies = malloc(MAX_BURSTS * sizeof(*latencies));
+	if (latencies == NULL) return EXIT_FAILURE;
+
+	for (size_t i = 0; i < NELEMS(storms); i++) {
+		for (int io_uring = 0; io_uring < 2; io_uring++) {
+			if (runStorm(out, &storms[i], io_uring, latencies) != 0) {
+				perror(io_uring ? "io_uring" : "epoll");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	free(latencies);
+	fclose(out);
+	return EXIT_SUCCESS;
+}
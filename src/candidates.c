@@ -0,0 +1,69 @@
+#include <string.h>
+
+#include "candidates.h"
+
+static struct Candidate * findCandidate(struct CandidateSet * set, struct IPAddr const * addr) {
+	for (size_t i = 0; i < set->n; i++) {
+		if (addrEqual(set->candidates[i].addr, *addr)) return &set->candidates[i];
+	}
+	return NULL;
+}
+
+static bool preferred(struct Candidate const * candidate, uint64_t now) {
+	return candidate->preferred_until > now;
+}
+
+// Classes outrank lifetimes: preferred over expired, then stable over temporary
+static int candidateClass(struct Candidate const * candidate, uint64_t now) {
+	return preferred(candidate, now) * 2 + !candidate->temporary;
+}
+
+// Positive if a ranks above b. Total, so the choice doesn't depend on arrival order.
+static int compareCandidates(struct Candidate const * a, struct Candidate const * b, uint64_t now) {
+	int class_a = candidateClass(a, now);
+	int class_b = candidateClass(b, now);
+	if (class_a != class_b) return class_a - class_b;
+	if (a->preferred_until != b->preferred_until) return a->preferred_until > b->preferred_until ? 1 : -1;
+	if (a->valid_until != b->valid_until) return a->valid_until > b->valid_until ? 1 : -1;
+	size_t len = a->addr.af == AF_INET ? sizeof(a->addr.ipv4) : sizeof(a->addr.ipv6);
+	return memcmp(&b->addr, &a->addr, len);
+}
+
+void candidateUpdate(struct CandidateSet * set, struct Candidate const * candidate, uint64_t now) {
+	struct Candidate * existing = findCandidate(set, &candidate->addr);
+	if (existing != NULL) {
+		*existing = *candidate;
+		return;
+	}
+	if (set->n < CANDIDATES_MAX) {
+		set->candidates[set->n++] = *candidate;
+		return;
+	}
+
+	// Full, replace the worst if this is better
+	struct Candidate * worst = &set->candidates[0];
+	for (size_t i = 1; i < set->n; i++) {
+		if (compareCandidates(&set->candidates[i], worst, now) < 0) worst = &set->candidates[i];
+	}
+	if (compareCandidates(candidate, worst, now) > 0) *worst = *candidate;
+}
+
+void candidateRemove(struct CandidateSet * set, struct IPAddr const * addr) {
+	struct Candidate * existing = findCandidate(set, addr);
+	if (existing == NULL) return;
+	*existing = set->candidates[--set->n];
+}
+
+struct Candidate const * candidateSelect(struct CandidateSet const * set, struct IPAddr const * current,
+                                         uint64_t now) {
+	struct Candidate const * best = NULL;
+	struct Candidate const * kept = NULL;
+	for (size_t i = 0; i < set->n; i++) {
+		struct Candidate const * candidate = &set->candidates[i];
+		if (candidate->valid_until <= now) continue;
+		if (addrEqual(candidate->addr, *current)) kept = candidate;
+		if (best == NULL || compareCandidates(candidate, best, now) > 0) best = candidate;
+	}
+	if (kept != NULL && candidateClass(kept, now) == candidateClass(best, now)) return kept;
+	return best;
+}
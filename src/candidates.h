@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ipaddr.h"
+
+// Addresses of one family tracked per interface, any more are only kept if
+// they rank above one already held
+#define CANDIDATES_MAX 8
+
+struct Candidate {
+	struct IPAddr addr;
+	bool temporary;
+	// IFA_F_* as last reported
+	uint32_t flags;
+	// CLOCK_MONOTONIC seconds, UINT64_MAX if forever. Deprecated addresses
+	// have a preferred_until in the past, and are only chosen as a last resort.
+	uint64_t preferred_until;
+	uint64_t valid_until;
+};
+
+// Addresses of one family on one interface
+struct CandidateSet {
+	struct Candidate candidates[CANDIDATES_MAX];
+	size_t n;
+};
+
+// Adds candidate, or refreshes its flags and lifetimes if already present
+void candidateUpdate(struct CandidateSet * set, struct Candidate const * candidate, uint64_t now);
+void candidateRemove(struct CandidateSet * set, struct IPAddr const * addr);
+// The address to publish, NULL if there is none. current is kept while no
+// candidate is in a better class, so lifetime refreshes don't flip between
+// equally good addresses.
+struct Candidate const * candidateSelect(struct CandidateSet const * set, struct IPAddr const * current,
+                                         uint64_t now);
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "config.h"
+#include "util.h"
+
+static int addString(char ** list, size_t * n, size_t max, char const * value, size_t len) {
+	if (*n == max) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if ((list[*n] = strndup(value, len)) == NULL) return -1;
+	(*n)++;
+	return 0;
+}
+
+// <URL> [check <name>], URLs have no blanks in them
+static int parseUrl(struct Config * config, char const * value) {
+	size_t const url_len = strcspn(value, " \t");
+	char const * check = value + url_len + strspn(value + url_len, " \t");
+	char const * name = NULL;
+	if (*check != '\0') {
+		size_t const key_len = strcspn(check, " \t");
+		name = check + key_len + strspn(check + key_len, " \t");
+		if (key_len != 5 || strncmp(check, "check", 5) != 0 || *name == '\0' || strpbrk(name, " \t") != NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (addString(config->urls, &config->n_urls, NELEMS(config->urls), value, url_len) != 0) return -1;
+	if (name != NULL && (config->check_names[config->n_urls - 1] = strdup(name)) == NULL) return -1;
+	return 0;
+}
+
+// A line with its newline and surrounding blanks stripped
+static int parseLine(struct Config * config, char * line) {
+	char * key = line + strspn(line, " \t");
+	size_t key_len = strcspn(key, " \t");
+	char * value = key + key_len + strspn(key + key_len, " \t");
+	key[key_len] = '\0';
+
+	struct {
+		char const * name;
+		bool * flag;
+	} const flags[] = {
+		{"ipv4", &config->ipv4},
+		{"ipv6", &config->ipv6},
+		{"allow-private", &config->allow_private},
+		{"allow-temporary", &config->allow_temporary},
+	};
+	for (size_t i = 0; i < NELEMS(flags); i++) {
+		if (strcmp(key, flags[i].name) != 0) continue;
+		if (*value != '\0') goto invalid;
+		*flags[i].flag = true;
+		return 0;
+	}
+
+	if (*value == '\0') goto invalid;
+	if (strcmp(key, "url") == 0) return parseUrl(config, value);
+	if (strcmp(key, "interface") != 0) goto invalid;
+	for (char const * iface = value; *iface != '\0';) {
+		size_t len = strcspn(iface, ",");
+		if (len == 0) goto invalid;
+		if (addString(config->ifaces, &config->n_ifaces, NELEMS(config->ifaces), iface, len) != 0) return -1;
+		iface += len;
+		if (*iface == ',') iface++;
+	}
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+int loadConfig(struct Config * config, char const * path) {
+	memset(config, 0, sizeof(*config));
+	FILE * file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Couldn't open config %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	char line[CONFIG_MAX_LINE];
+	unsigned int line_no = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line_no++;
+		size_t len = strlen(line);
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		} else if (!feof(file)) {
+			errno = E2BIG;
+			goto invalid;
+		}
+		while (len > 0 && strchr(" \t\r", line[len - 1]) != NULL) line[--len] = '\0';
+		char const * start = line + strspn(line, " \t");
+		if (*start == '\0' || *start == '#') continue;
+		if (parseLine(config, line) != 0) goto invalid;
+	}
+	if (ferror(file)) {
+		fprintf(stderr, "Couldn't read config %s: %s\n", path, strerror(errno));
+		goto cleanup;
+	}
+	fclose(file);
+
+	// Both unless either is given, as on the command line
+	if (!config->ipv4 && !config->ipv6) config->ipv4 = config->ipv6 = true;
+	if (config->n_ifaces == 0) {
+		fprintf(stderr, "%s: no interface given\n", path);
+		destroyConfig(config);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+
+invalid:
+	fprintf(stderr, "%s:%u: %s\n", path, line_no, errno == EINVAL ? "invalid setting"
+	                                              : errno == ENOSPC ? "too many entries" : strerror(errno));
+	errno = EINVAL;
+cleanup:
+	fclose(file);
+	destroyConfig(config);
+	return -1;
+}
+
+void destroyConfig(struct Config * config) {
+	for (size_t i = 0; i < config->n_ifaces; i++) free(config->ifaces[i]);
+	config->n_ifaces = 0;
+	for (size_t i = 0; i < config->n_urls; i++) {
+		free(config->urls[i]);
+		free(config->check_names[i]);
+		config->check_names[i] = NULL;
+	}
+	config->n_urls = 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "filter.h"
+
+// Longest line accepted, URLs included
+#define CONFIG_MAX_LINE 4096
+#define CONFIG_MAX_URLS 64
+
+// What --config FILE describes, one setting per line:
+//
+//   interface <interface>[@<netns>][,<interface>[@<netns>]...]
+//   url <URL> [check <name>]
+//   ipv4 | ipv6 | allow-private | allow-temporary
+//
+// interface and url may be repeated. Blank lines and lines starting with #
+// are ignored.
+struct Config {
+	// As on the command line, <interface>[@<netns>]
+	char * ifaces[FILTER_MAX_IFACES];
+	size_t n_ifaces;
+	char * urls[CONFIG_MAX_URLS];
+	// Record each URL's updates are checked against, NULL if none
+	char * check_names[CONFIG_MAX_URLS];
+	size_t n_urls;
+	bool ipv4;
+	bool ipv6;
+	bool allow_private;
+	bool allow_temporary;
+};
+
+// Says what is wrong with the file on stderr, and returns -1 with errno EINVAL
+int loadConfig(struct Config * config, char const * path);
+void destroyConfig(struct Config * config);
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+
+#include <netdb.h>
+
+#include "dns.h"
+#include "strlcpy.h"
+#include "util.h"
+
+static char const * const rcode_names[] = {
+	"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+	"YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
+};
+
+char const * rcodeName(unsigned int rcode) {
+	switch (rcode) {
+	case 16: return "BADSIG";
+	case 17: return "BADKEY";
+	case 18: return "BADTIME";
+	}
+	return rcode < NELEMS(rcode_names) ? rcode_names[rcode] : "unknown error";
+}
+
+size_t encodeName(char const * text, size_t text_len, unsigned char * dst, bool lowercase) {
+	size_t len = 0;
+	if (text_len > 0 && text[text_len - 1] == '.') text_len--;
+	while (text_len > 0) {
+		char const * dot = memchr(text, '.', text_len);
+		size_t label_len = dot == NULL ? text_len : (size_t) (dot - text);
+		if (label_len == 0 || label_len > 63 || len + label_len + 2 > DNS_MAX_NAME) return 0;
+		dst[len++] = label_len;
+		for (size_t i = 0; i < label_len; i++) {
+			dst[len++] = lowercase ? tolower((unsigned char) text[i]) : text[i];
+		}
+		text += label_len;
+		text_len -= label_len;
+		if (dot != NULL) {
+			text++;
+			text_len--;
+		}
+	}
+	dst[len++] = 0;
+	return len;
+}
+
+int resolveServer(char const * server, struct sockaddr_storage * addr, socklen_t * addr_len) {
+	char host[DNS_MAX_NAME + 1];
+	char const * port = DNS_PORT;
+	if (server[0] == '[') {
+		char const * end = strchr(server, ']');
+		if (end == NULL || (size_t) (end - server) > sizeof(host)) goto invalid;
+		strlcpy(host, server + 1, end - server);
+		if (end[1] == ':') port = end + 2;
+		else if (end[1] != '\0') goto invalid;
+	} else {
+		if (strlcpy(host, server, sizeof(host)) >= sizeof(host)) goto invalid;
+		// More than one colon is a bare IPv6 address
+		char * colon = strchr(host, ':');
+		if (colon != NULL && strchr(colon + 1, ':') == NULL) {
+			*colon = '\0';
+			port = server + (colon + 1 - host);
+		}
+	}
+
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_flags = AI_NUMERICSERV,
+	};
+	struct addrinfo * result;
+	int error = getaddrinfo(host, port, &hints, &result);
+	if (error != 0) {
+		fprintf(stderr, "Couldn't resolve DNS server %s: %s\n", server, gai_strerror(error));
+		errno = error == EAI_SYSTEM ? errno : EINVAL;
+		return -1;
+	}
+	memcpy(addr, result->ai_addr, result->ai_addrlen);
+	*addr_len = result->ai_addrlen;
+	freeaddrinfo(result);
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+unsigned char * put16(unsigned char * p, uint16_t value) {
+	p[0] = value >> 8;
+	p[1] = value;
+	return p + 2;
+}
+
+unsigned char * put32(unsigned char * p, uint32_t value) {
+	p = put16(p, value >> 16);
+	return put16(p, value);
+}
+
+unsigned char * put48(unsigned char * p, uint64_t value) {
+	p = put16(p, value >> 32);
+	return put32(p, value);
+}
+
+unsigned char * putBytes(unsigned char * p, void const * src, size_t len) {
+	memcpy(p, src, len);
+	return p + len;
+}
+
+uint16_t get16(unsigned char const * p) {
+	return p[0] << 8 | p[1];
+}
+
+unsigned char const * skipName(unsigned char const * p, unsigned char const * end) {
+	while (p < end) {
+		if (*p == 0) return p + 1;
+		if ((*p & 0xC0) == 0xC0) return p + 2 <= end ? p + 2 : NULL;
+		p += *p + 1;
+	}
+	return NULL;
+}
+
+unsigned char const * compareName(unsigned char const * msg, unsigned char const * end,
+                                  unsigned char const * p, unsigned char const * name, bool * equal) {
+	unsigned char const * next = NULL;
+	*equal = true;
+	for (unsigned int hops = 0; p < end;) {
+		if ((*p & 0xC0) == 0xC0) {
+			// Bounded, pointers may loop
+			if (p + 2 > end || ++hops > DNS_MAX_NAME / 2) return NULL;
+			if (next == NULL) next = p + 2;
+			p = msg + ((p[0] & 0x3F) << 8 | p[1]);
+			continue;
+		}
+		if (p + *p + 1 > end) return NULL;
+		if (*equal && *p != *name) *equal = false;
+		for (size_t i = 1; *equal && i <= *p; i++) {
+			if (tolower(p[i]) != tolower(name[i])) *equal = false;
+		}
+		if (*p == 0) return next != NULL ? next : p + 1;
+		if (*equal) name += *name + 1;
+		p += *p + 1;
+	}
+	return NULL;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/socket.h>
+
+// Wire format shared by DNS UPDATE and the published record check
+
+// Limits, RFC 1035
+#define DNS_MAX_NAME 255
+#define DNS_PORT "53"
+#define DNS_HEADER_LEN 12
+// Largest reply, TCP replies can't be any longer
+#define DNS_MAX_REPLY 65535
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_TC 0x0200
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+
+#define DNS_RCODE_NXDOMAIN 3
+
+char const * rcodeName(unsigned int rcode);
+// Text to wire format, returns the length or 0 if not a valid name
+size_t encodeName(char const * text, size_t text_len, unsigned char * dst, bool lowercase);
+// host, host:port or [ipv6]:port, resolved once
+int resolveServer(char const * server, struct sockaddr_storage * addr, socklen_t * addr_len);
+unsigned char * put16(unsigned char * p, uint16_t value);
+unsigned char * put32(unsigned char * p, uint32_t value);
+unsigned char * put48(unsigned char * p, uint64_t value);
+unsigned char * putBytes(unsigned char * p, void const * src, size_t len);
+uint16_t get16(unsigned char const * p);
+// Skip a possibly compressed name, returns NULL if it runs past end
+unsigned char const * skipName(unsigned char const * p, unsigned char const * end);
+// Compare the possibly compressed name at p to name, ignoring case. Returns
+// the end of the name at p, or NULL if it is malformed.
+unsigned char const * compareName(unsigned char const * msg, unsigned char const * end,
+                                  unsigned char const * p, unsigned char const * name, bool * equal);
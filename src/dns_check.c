@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "dns_check.h"
+#include "timespec.h"
+#include "util.h"
+
+#define DNS_FLAG_AA 0x0400
+// Without EDNS, UDP replies are at most 512 bytes
+#define DNS_MAX_UDP 512
+
+int createDnsCheck(struct DnsCheck * check, char const * server) {
+	memset(check, 0, sizeof(*check));
+	check->fd = -1;
+	if (resolveServer(server, &check->server, &check->server_len) != 0) return -1;
+
+	check->fd = socket(check->server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (check->fd == -1) return -1;
+	// Connected, so the kernel drops datagrams from anyone but the server
+	if (connect(check->fd, (struct sockaddr *) &check->server, check->server_len) == -1) goto cleanup;
+	return 0;
+
+cleanup:
+	destroyDnsCheck(check);
+	return -1;
+}
+
+void destroyDnsCheck(struct DnsCheck * check) {
+	if (check->fd >= 0) close(check->fd);
+	check->fd = -1;
+	check->active = NULL;
+}
+
+void cancelDnsQuery(struct DnsCheck * check, struct DnsQuery * query) {
+	if (!query->active) return;
+	query->active = false;
+	for (struct DnsQuery ** link = &check->active; *link != NULL; link = &(*link)->next) {
+		if (*link != query) continue;
+		*link = query->next;
+		break;
+	}
+	query->next = NULL;
+}
+
+static void failQuery(struct DnsCheck * check, struct DnsQuery * query) {
+	cancelDnsQuery(check, query);
+	query->failed = true;
+	query->n_answers = 0;
+}
+
+int startDnsQuery(struct DnsCheck * check, struct DnsQuery * query, char const * name, int af) {
+	unsigned char encoded[DNS_MAX_NAME];
+	size_t const name_len = encodeName(name, strlen(name), encoded, false);
+	if (name_len == 0) {
+		// Not fatal, the update just goes ahead
+		printf("Can't check published record of invalid name %s\n", name);
+		cancelDnsQuery(check, query);
+		query->failed = true;
+		return 0;
+	}
+	uint16_t const type = af == AF_INET ? DNS_TYPE_A : DNS_TYPE_AAAA;
+	if (query->active && query->type == type && query->name_len == name_len
+	    && memcmp(query->name, encoded, name_len) == 0) return 0;
+
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+	cancelDnsQuery(check, query);
+	if (getrandom(&query->id, sizeof(query->id), GRND_NONBLOCK) != sizeof(query->id)) query->id = random();
+	memcpy(query->name, encoded, name_len);
+	query->name_len = name_len;
+	query->type = type;
+	query->active = true;
+	query->failed = false;
+	query->deadline = timespecAddMs(now, DNS_CHECK_TIMEOUT_MS);
+	query->answer = (struct IPAddr) {.af = AF_UNSPEC};
+	query->n_answers = 0;
+	query->next = check->active;
+	check->active = query;
+
+	// No recursion, the server is to answer from its own zone
+	unsigned char msg[DNS_HEADER_LEN + DNS_MAX_NAME + 4];
+	unsigned char * p = put16(msg, query->id);
+	p = put16(p, 0);
+	p = put16(p, 1);
+	p = put16(p, 0);
+	p = put16(p, 0);
+	p = put16(p, 0);
+	memcpy(p, query->name, query->name_len);
+	p += query->name_len;
+	p = put16(p, type);
+	p = put16(p, DNS_CLASS_IN);
+
+	if (send(check->fd, msg, p - msg, 0) == -1) {
+		// Not fatal, the update just goes ahead
+		printf("Couldn't check published record: %s\n", strerror(errno));
+		failQuery(check, query);
+	}
+	return 0;
+}
+
+static void processReply(struct DnsCheck * check, unsigned char const * reply, size_t len) {
+	if (len < DNS_HEADER_LEN) return;
+	struct DnsQuery * query = check->active;
+	while (query != NULL && query->id != get16(reply)) query = query->next;
+	uint16_t flags = get16(reply + 2);
+	// Anything else is stale or forged
+	if (query == NULL || !(flags & DNS_FLAG_QR) || (flags >> 11 & 0xF) != 0 || get16(reply + 4) != 1) return;
+	uint16_t const type = query->type;
+	unsigned char const * end = reply + len;
+	bool equal;
+	unsigned char const * p = compareName(reply, end, reply + DNS_HEADER_LEN, query->name, &equal);
+	if (p == NULL || !equal || p + 4 > end || get16(p) != type || get16(p + 2) != DNS_CLASS_IN) return;
+	p += 4;
+
+	unsigned int rcode = flags & 0xF;
+	cancelDnsQuery(check, query);
+	if (flags & DNS_FLAG_TC) {
+		puts("Published record check truncated");
+		failQuery(check, query);
+		return;
+	}
+	// A resolver's cache could be out of date
+	if (!(flags & DNS_FLAG_AA)) {
+		puts("Published record check not answered authoritatively");
+		failQuery(check, query);
+		return;
+	}
+	if (rcode == DNS_RCODE_NXDOMAIN) return;
+	if (rcode != 0) {
+		printf("Published record check failed: %s\n", rcodeName(rcode));
+		failQuery(check, query);
+		return;
+	}
+
+	size_t const addr_len = type == DNS_TYPE_A ? sizeof(query->answer.ipv4) : sizeof(query->answer.ipv6);
+	unsigned int const n_records = get16(reply + 6);
+	for (unsigned int i = 0; i < n_records; i++) {
+		p = compareName(reply, end, p, query->name, &equal);
+		if (p == NULL || p + 10 > end || p + 10 + get16(p + 8) > end) {
+			puts("Malformed reply to published record check");
+			failQuery(check, query);
+			return;
+		}
+		unsigned char const * rdata = p + 10;
+		uint16_t rdata_len = get16(p + 8);
+		// Aliases aren't followed, so a CNAME counts as not published
+		if (equal && get16(p) == type && get16(p + 2) == DNS_CLASS_IN && rdata_len == addr_len
+		    && query->n_answers++ == 0) {
+			memcpy(&query->answer, rdata, addr_len);
+			query->answer.af = type == DNS_TYPE_A ? AF_INET : AF_INET6;
+		}
+		p = rdata + rdata_len;
+	}
+}
+
+int receiveDnsCheck(struct DnsCheck * check) {
+	unsigned char reply[DNS_MAX_UDP];
+	for (;;) {
+		ssize_t len = recv(check->fd, reply, sizeof(reply), 0);
+		if (len == -1 && errno == EAGAIN) return 0;
+		if (len == -1 && errno == ECONNREFUSED) {
+			puts("Published record check refused by server");
+			while (check->active != NULL) failQuery(check, check->active);
+			return 0;
+		}
+		if (len == -1) return -1;
+		processReply(check, reply, len);
+	}
+}
+
+void expireDnsCheck(struct DnsCheck * check, struct timespec now) {
+	for (struct DnsQuery * query = check->active, * next; query != NULL; query = next) {
+		next = query->next;
+		if (timespecBefore(now, query->deadline)) continue;
+		puts("Published record check timed out");
+		failQuery(check, query);
+	}
+}
+
+bool dnsCheckDeadline(struct DnsCheck const * check, struct timespec * deadline) {
+	bool have_deadline = false;
+	for (struct DnsQuery const * query = check->active; query != NULL; query = query->next) {
+		if (!have_deadline || timespecBefore(query->deadline, *deadline)) *deadline = query->deadline;
+		have_deadline = true;
+	}
+	return have_deadline;
+}
+
+enum DnsCheckResult dnsQueryResult(struct DnsQuery const * query, struct IPAddr const * addr) {
+	if (query->active) return DNS_CHECK_PENDING;
+	if (query->failed) return DNS_CHECK_FAILED;
+	return query->n_answers == 1 && addrEqual(query->answer, *addr) ? DNS_CHECK_PUBLISHED : DNS_CHECK_MISSING;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <time.h>
+#include <sys/socket.h>
+
+#include "dns.h"
+#include "ipaddr.h"
+
+// Asks a record's authoritative server what it holds, to skip updates the
+// provider already has. Queries belong to whoever asks, and share a connected
+// non-blocking UDP socket polled by the caller.
+#define DNS_CHECK_TIMEOUT_MS 2000
+
+enum DnsCheckResult {
+	DNS_CHECK_PENDING,
+	// The record holds exactly the address
+	DNS_CHECK_PUBLISHED,
+	// It holds something else, or nothing
+	DNS_CHECK_MISSING,
+	// No usable answer, so nothing is known
+	DNS_CHECK_FAILED,
+};
+
+// A lookup of one name and type. Zeroed, it has never been started.
+struct DnsQuery {
+	bool active;
+	bool failed;
+	uint16_t id;
+	uint16_t type;
+	unsigned char name[DNS_MAX_NAME];
+	size_t name_len;
+	struct timespec deadline;
+	// First address of the answer, and how many there were
+	struct IPAddr answer;
+	unsigned int n_answers;
+	// Next in flight on the same check
+	struct DnsQuery * next;
+};
+
+struct DnsCheck {
+	struct sockaddr_storage server;
+	socklen_t server_len;
+	int fd;
+	// In flight, to match replies to
+	struct DnsQuery * active;
+};
+
+// server is host, host:port or [ipv6]:port, resolved once
+int createDnsCheck(struct DnsCheck * check, char const * server);
+void destroyDnsCheck(struct DnsCheck * check);
+// Look up the record of af under name, unless that lookup is already in flight. The query
+// must stay put until done or cancelled.
+int startDnsQuery(struct DnsCheck * check, struct DnsQuery * query, char const * name, int af);
+// Forget the query, e.g. before freeing it, any reply is then ignored
+void cancelDnsQuery(struct DnsCheck * check, struct DnsQuery * query);
+// Read whatever replies have arrived
+int receiveDnsCheck(struct DnsCheck * check);
+// Give up on lookups past their deadline
+void expireDnsCheck(struct DnsCheck * check, struct timespec now);
+// Earliest deadline of the lookups in flight, false if there are none
+bool dnsCheckDeadline(struct DnsCheck const * check, struct timespec * deadline);
+// What the query's latest lookup says about addr
+enum DnsCheckResult dnsQueryResult(struct DnsQuery const * query, struct IPAddr const * addr);
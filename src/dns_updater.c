@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#include <openssl/crypto.h>
+
+#include "dns_updater.h"
+#include "util.h"
+
+#define DNS_OPCODE_UPDATE 5
+
+#define DNS_TYPE_SOA 6
+#define DNS_CLASS_ANY 255
+
+#define DNS_RCODE_SERVFAIL 2
+
+static int addEpoll(struct DnsUpdater * updater, int fd, uint32_t events, struct EpollData ** data) {
+	*data = malloc(sizeof(**data));
+	if (*data == NULL) return -1;
+	(*data)->tag = EPOLL_DNS_UPDATER;
+	(*data)->fd = fd;
+	(*data)->dns_updater = updater;
+	struct epoll_event event = {
+		.events = events,
+		.data = { .ptr = *data },
+	};
+	return epoll_ctl(updater->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void closeEpoll(struct DnsUpdater * updater, int * fd, struct EpollData ** data) {
+	if (*fd >= 0) {
+		epoll_ctl(updater->epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+		close(*fd);
+	}
+	*fd = -1;
+	free(*data);
+	*data = NULL;
+}
+
+Updater_t createDnsUpdater(int epoll_fd, struct DnsUpdaterOptions options) {
+	Updater_t data = malloc(sizeof(*data));
+	if (data == NULL) return NULL;
+	data->tag = DNS_UPDATER;
+	struct DnsUpdater * updater = &data->dns;
+	memset(updater, 0, sizeof(*updater));
+	updater->options = options;
+	updater->epoll_fd = epoll_fd;
+	updater->udp_fd = -1;
+	updater->timer_fd = -1;
+	updater->tcp_fd = -1;
+
+	updater->zone_len = encodeName(options.zone, strlen(options.zone), updater->zone, false);
+	if (options.name != NULL) {
+		updater->name_len = encodeName(options.name, strlen(options.name), updater->name, false);
+	} else {
+		char name[DNS_MAX_NAME + 1];
+		if (snprintf(name, sizeof(name), "%s.%s", options.hostname, options.zone) < (int) sizeof(name)) {
+			updater->name_len = encodeName(name, strlen(name), updater->name, false);
+		}
+	}
+	if (updater->zone_len == 0 || updater->name_len == 0) {
+		errno = EINVAL;
+		goto cleanup;
+	}
+	if (options.tsig_key != NULL && parseTsigKey(options.tsig_key, &updater->key) != 0) goto cleanup;
+	if (resolveServer(options.server, &updater->server, &updater->server_len) != 0) goto cleanup;
+
+	// With room for TCP's length prefix
+	updater->reply = malloc(DNS_MAX_REPLY + 2);
+	if (updater->reply == NULL) goto cleanup;
+
+	updater->udp_fd = socket(updater->server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (updater->udp_fd == -1) goto cleanup;
+	// Connected, so the kernel drops datagrams from anyone but the server
+	if (connect(updater->udp_fd, (struct sockaddr *) &updater->server, updater->server_len) == -1) goto cleanup;
+	if (addEpoll(updater, updater->udp_fd, EPOLLIN, &updater->udp_data) == -1) goto cleanup;
+
+	updater->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (updater->timer_fd == -1) goto cleanup;
+	if (addEpoll(updater, updater->timer_fd, EPOLLIN, &updater->timer_data) == -1) goto cleanup;
+
+	return data;
+
+cleanup:
+	destroyDnsUpdater(updater);
+	free(data);
+	return NULL;
+}
+
+void destroyDnsUpdater(struct DnsUpdater * updater) {
+	closeEpoll(updater, &updater->tcp_fd, &updater->tcp_data);
+	closeEpoll(updater, &updater->timer_fd, &updater->timer_data);
+	closeEpoll(updater, &updater->udp_fd, &updater->udp_data);
+	free(updater->reply);
+	updater->reply = NULL;
+	OPENSSL_cleanse(&updater->key, sizeof(updater->key));
+}
+
+// Replace the RRset of addr's type with addr
+static unsigned char * putRecord(struct DnsUpdater const * updater, unsigned char * p, struct IPAddr const * addr) {
+	uint16_t type = addr->af == AF_INET ? DNS_TYPE_A : DNS_TYPE_AAAA;
+	size_t len = addr->af == AF_INET ? sizeof(addr->ipv4) : sizeof(addr->ipv6);
+
+	p = putBytes(p, updater->name, updater->name_len);
+	p = put16(p, type);
+	p = put16(p, DNS_CLASS_ANY);
+	p = put32(p, 0);
+	p = put16(p, 0);
+
+	p = putBytes(p, updater->name, updater->name_len);
+	p = put16(p, type);
+	p = put16(p, DNS_CLASS_IN);
+	p = put32(p, updater->options.ttl);
+	p = put16(p, len);
+	return putBytes(p, addr, len);
+}
+
+static int buildQuery(struct DnsUpdater * updater) {
+	if (getrandom(&updater->id, sizeof(updater->id), GRND_NONBLOCK) != sizeof(updater->id)) {
+		updater->id = random();
+	}
+	unsigned int n_records = (updater->ipv4.af != AF_UNSPEC) + (updater->ipv6.af != AF_UNSPEC);
+
+	unsigned char * p = put16(updater->query, updater->id);
+	p = put16(p, DNS_OPCODE_UPDATE << 11);
+	// Zone, prerequisite, update and additional counts
+	p = put16(p, 1);
+	p = put16(p, 0);
+	p = put16(p, 2 * n_records);
+	p = put16(p, 0);
+
+	p = putBytes(p, updater->zone, updater->zone_len);
+	p = put16(p, DNS_TYPE_SOA);
+	p = put16(p, DNS_CLASS_IN);
+	if (updater->ipv4.af != AF_UNSPEC) p = putRecord(updater, p, &updater->ipv4);
+	if (updater->ipv6.af != AF_UNSPEC) p = putRecord(updater, p, &updater->ipv6);
+
+	updater->query_len = p - updater->query;
+	if (updater->key.md == NULL) return 0;
+	updater->query_len = tsigSign(&updater->key, updater->query, updater->query_len, time(NULL),
+	                              updater->query_mac, &updater->query_mac_len);
+	return updater->query_len == 0 ? -1 : 0;
+}
+
+static int armTimer(struct DnsUpdater * updater) {
+	unsigned long long timeout = updater->options.retry_base_ms;
+	for (unsigned int i = 0; i < updater->attempts && timeout < updater->options.retry_max_ms; i++) timeout *= 2;
+	if (timeout > updater->options.retry_max_ms) timeout = updater->options.retry_max_ms;
+
+	struct itimerspec timer = {
+		.it_value = {
+			.tv_sec = timeout / 1000,
+			.tv_nsec = timeout % 1000 * 1000000,
+		},
+	};
+	return timerfd_settime(updater->timer_fd, 0, &timer, NULL);
+}
+
+static void finish(struct DnsUpdater * updater) {
+	struct itimerspec disarm = {0};
+	timerfd_settime(updater->timer_fd, 0, &disarm, NULL);
+	closeEpoll(updater, &updater->tcp_fd, &updater->tcp_data);
+	updater->active = false;
+}
+
+static int sendQuery(struct DnsUpdater * updater) {
+	closeEpoll(updater, &updater->tcp_fd, &updater->tcp_data);
+	if (buildQuery(updater) != 0) return -1;
+	if (armTimer(updater) != 0) return -1;
+	// Lost datagrams are covered by the timer
+	if (send(updater->udp_fd, updater->query, updater->query_len, 0) == -1
+	    && errno != EAGAIN && errno != ECONNREFUSED) return -1;
+	return 0;
+}
+
+// Gives up once out of retries, until the next change
+static int retry(struct DnsUpdater * updater) {
+	if (updater->attempts >= updater->options.max_retries) {
+		puts("Giving up on DNS update");
+		updater->stats.failed++;
+		finish(updater);
+		return 0;
+	}
+	updater->attempts++;
+	updater->stats.retried++;
+	return sendQuery(updater);
+}
+
+static int startTcp(struct DnsUpdater * updater) {
+	// Already underway for a duplicate of the truncated reply
+	if (updater->tcp_fd >= 0) return 0;
+	updater->tcp_fd = socket(updater->server.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (updater->tcp_fd == -1) return -1;
+	updater->tcp_connected = false;
+	updater->tcp_sent = 0;
+	updater->reply_len = 0;
+	if (connect(updater->tcp_fd, (struct sockaddr *) &updater->server, updater->server_len) == -1
+	    && errno != EINPROGRESS) {
+		closeEpoll(updater, &updater->tcp_fd, &updater->tcp_data);
+		return retry(updater);
+	}
+	return addEpoll(updater, updater->tcp_fd, EPOLLOUT, &updater->tcp_data);
+}
+
+static int processReply(struct DnsUpdater * updater, unsigned char const * reply, size_t len, bool tcp) {
+	// Anything else is stale or forged
+	if (!updater->active || len < DNS_HEADER_LEN || get16(reply) != updater->id) return 0;
+	uint16_t flags = get16(reply + 2);
+	if (!(flags & DNS_FLAG_QR) || (flags >> 11 & 0xF) != DNS_OPCODE_UPDATE) return 0;
+
+	if (flags & DNS_FLAG_TC && !tcp) {
+		if (updater->options.verbose) puts("DNS reply truncated, retrying over TCP");
+		return startTcp(updater);
+	}
+
+	unsigned int rcode = flags & 0xF;
+	uint16_t tsig_error = 0;
+	if (updater->key.md != NULL && !tsigVerify(&updater->key, updater->query_mac, updater->query_mac_len,
+	                                           reply, len, time(NULL), &tsig_error)) {
+		// A server that can't verify us replies unsigned with the reason
+		if (tsig_error != 0) rcode = tsig_error;
+		if (rcode == 0) {
+			puts("DNS update reply failed TSIG verification, ignored");
+			return 0;
+		}
+	}
+
+	finish(updater);
+	if (rcode == 0) {
+		puts("Updated DNS");
+		updater->stats.succeeded++;
+		observeLatency(&updater->stats, updater->received);
+		return 0;
+	}
+	printf("DNS update failed: %s\n", rcodeName(rcode));
+	updater->active = rcode == DNS_RCODE_SERVFAIL;
+	if (!updater->active) updater->stats.failed++;
+	return updater->active ? retry(updater) : 0;
+}
+
+static int processTcp(struct DnsUpdater * updater, int32_t events) {
+	if (!updater->tcp_connected) {
+		int error;
+		socklen_t error_len = sizeof(error);
+		if (getsockopt(updater->tcp_fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) return -1;
+		if (error == EINPROGRESS) return 0;
+		if (error != 0) {
+			printf("DNS update over TCP failed: %s\n", strerror(error));
+			closeEpoll(updater, &updater->tcp_fd, &updater->tcp_data);
+			return 0;
+		}
+		updater->tcp_connected = true;
+	}
+
+	if (updater->tcp_sent < updater->query_len + 2) {
+		unsigned char prefix[2];
+		put16(prefix, updater->query_len);
+		struct iovec iov[2] = {
+			{ .iov_base = prefix, .iov_len = sizeof(prefix) },
+			{ .iov_base = updater->query, .iov_len = updater->query_len },
+		};
+		size_t skip = updater->tcp_sent;
+		for (size_t i = 0; i < NELEMS(iov); i++) {
+			size_t n = skip < iov[i].iov_len ? skip : iov[i].iov_len;
+			iov[i].iov_base = (char *) iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+			skip -= n;
+		}
+		ssize_t sent = writev(updater->tcp_fd, iov, NELEMS(iov));
+		if (sent == -1) return errno == EAGAIN ? 0 : -1;
+		updater->tcp_sent += sent;
+		if (updater->tcp_sent < updater->query_len + 2) return 0;
+
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data = { .ptr = updater->tcp_data },
+		};
+		return epoll_ctl(updater->epoll_fd, EPOLL_CTL_MOD, updater->tcp_fd, &event);
+	}
+
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return 0;
+	// Length prefix, then the reply
+	size_t want = updater->reply_len < 2 ? 2 : 2 + get16(updater->reply);
+	ssize_t received = recv(updater->tcp_fd, updater->reply + updater->reply_len, want - updater->reply_len, 0);
+	if (received == -1) return errno == EAGAIN ? 0 : -1;
+	if (received == 0) {
+		puts("DNS server closed TCP connection");
+		closeEpoll(updater, &updater->tcp_fd, &updater->tcp_data);
+		return 0;
+	}
+	updater->reply_len += received;
+	if (updater->reply_len < 2 || updater->reply_len < 2 + (size_t) get16(updater->reply)) return 0;
+	return processReply(updater, updater->reply + 2, updater->reply_len - 2, true);
+}
+
+int handleDnsMessage(struct DnsUpdater * updater, int fd, int32_t events) {
+	if (fd == updater->timer_fd) {
+		uint64_t expirations;
+		if (read(fd, &expirations, sizeof(expirations)) == -1) return errno == EAGAIN ? 0 : -1;
+		if (!updater->active) return 0;
+		puts("DNS update timed out");
+		return retry(updater);
+	} else if (fd == updater->tcp_fd) {
+		return processTcp(updater, events);
+	}
+
+	for (;;) {
+		ssize_t len = recv(fd, updater->reply, DNS_MAX_REPLY, 0);
+		if (len == -1 && (errno == EAGAIN || errno == ECONNREFUSED)) return 0;
+		if (len == -1) return -1;
+		if (processReply(updater, updater->reply, len, false) != 0) return -1;
+	}
+}
+
+bool dnsUpdaterIdle(struct DnsUpdater const * updater) {
+	return !updater->active;
+}
+
+int dnsUpdate(struct DnsUpdater * updater, struct AddrEvent const * event) {
+	// Each update carries both families, so it can supersede one in flight
+	updater->ipv4 = event->ipv4;
+	updater->ipv6 = event->ipv6;
+	updater->active = true;
+	updater->attempts = 0;
+	updater->received = event->received;
+	updater->stats.issued++;
+
+	char addr[INET6_ADDRSTRLEN];
+	formatAddr(&event->addr, addr);
+	printf("Updating DNS with address: %s\n", addr);
+	return sendQuery(updater);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/socket.h>
+#include <openssl/evp.h>
+
+#include "dns.h"
+#include "ipaddr.h"
+#include "stats.h"
+#include "tsig.h"
+
+// Request size, plenty for a zone, four records and a TSIG
+#define DNS_MAX_MESSAGE 2048
+
+struct DnsUpdaterOptions {
+	bool verbose;
+	// Authoritative server as host, host:port or [ipv6]:port
+	char const * server;
+	char const * zone;
+	// Record to update, <hostname>.<zone> if NULL
+	char const * name;
+	char const * hostname;
+	unsigned int ttl;
+	// TSIG key as [algorithm:]name:base64 secret, NULL to send unsigned updates
+	char const * tsig_key;
+	// Unanswered updates and SERVFAIL are retried up to max_retries times,
+	// with the timeout doubling from retry_base_ms up to retry_max_ms
+	unsigned int max_retries;
+	unsigned int retry_base_ms;
+	unsigned int retry_max_ms;
+};
+
+struct DnsUpdater {
+	struct DnsUpdaterOptions options;
+	struct sockaddr_storage server;
+	socklen_t server_len;
+	unsigned char zone[DNS_MAX_NAME];
+	size_t zone_len;
+	unsigned char name[DNS_MAX_NAME];
+	size_t name_len;
+	// key.md is NULL if unsigned
+	struct DnsKey key;
+
+	int epoll_fd;
+	int udp_fd;
+	int timer_fd;
+	// Only open while falling back to TCP after a truncated reply
+	int tcp_fd;
+	struct EpollData * udp_data;
+	struct EpollData * timer_data;
+	struct EpollData * tcp_data;
+
+	// Update in flight, resent as a fresh message on each attempt
+	bool active;
+	struct IPAddr ipv4;
+	struct IPAddr ipv6;
+	unsigned int attempts;
+	// When the change being published was received
+	struct timespec received;
+	uint16_t id;
+	unsigned char query[DNS_MAX_MESSAGE];
+	size_t query_len;
+	// Responses are signed over the request's MAC
+	unsigned char query_mac[EVP_MAX_MD_SIZE];
+	unsigned int query_mac_len;
+
+	// TCP messages are prefixed by their length, both ways
+	bool tcp_connected;
+	size_t tcp_sent;
+	unsigned char * reply;
+	size_t reply_len;
+
+	struct UpdaterStats stats;
+};
+
+void destroyDnsUpdater(struct DnsUpdater * updater);
+int dnsUpdate(struct DnsUpdater * updater, struct AddrEvent const * event);
+int handleDnsMessage(struct DnsUpdater * updater, int fd, int32_t events);
+bool dnsUpdaterIdle(struct DnsUpdater const * updater);
+
+#include "updater.h"
+
+Updater_t createDnsUpdater(int epoll_fd, struct DnsUpdaterOptions options);
@@ -4,16 +4,28 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <fcntl.h>
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
 #include <net/if.h>
 
 #include "util.h"
 #include "filter.h"
 #include "monitor.h"
 #include "web_updater.h"
+#include "dns_updater.h"
 #include "updater.h"
+#include "netns.h"
+#include "metrics.h"
+#include "config.h"
+#include "timespec.h"
 
 #ifdef WITH_SYSTEMD
 #include <systemd/sd-daemon.h>
@@ -25,11 +37,444 @@ static char const version[] = "0.0.2";
 static void printUsage(){
 	puts("dyndns -V\n"
 	     "dyndns -h\n"
-	     "dyndns [-v] [-46] [--allow-temporary | -t] [--allow-private | -p] <interface> [URL]");
+	     "dyndns [-v] [-46] [--allow-temporary | -t] [--allow-private | -p] [--no-kernel-filter] [--combined]\n"
+	     "       [--settle MS [--max-delay MS]] [--retries N] [--retry-base MS] [--retry-max MS]\n"
+	     "       [--rate-interval MS [--rate-burst N]] [--preconnect]\n"
+	     "       [--check-server HOST[:PORT] --check-name NAME|- [--check-name NAME|-]...]\n"
+	     "       [--hostname NAME] [--state FILE] [--record FILE | --replay FILE [--replay-realtime]]\n"
+	     "       [--metrics [ADDR:]PORT | --metrics unix:PATH] [--json] [--threaded] [--io-uring]\n"
+	     "       <interface>[@<netns>][,<interface>[@<netns>]...] [URL...]\n"
+	     "dyndns [options] --dns-server HOST[:PORT] --dns-zone ZONE [--dns-name NAME] [--dns-ttl S]\n"
+	     "       [--tsig-key [ALG:]NAME:SECRET | --tsig-key-file FILE] <interface>\n"
+	     "dyndns [options] --exec COMMAND <interface>[,<interface>...]\n"
+	     "dyndns [options] --config FILE");
+}
+
+static bool parseUInt(char const * str, unsigned int * value) {
+	char * end;
+	errno = 0;
+	unsigned long result = strtoul(str, &end, 10);
+	if (errno != 0 || *str == '\0' || *end != '\0' || result > UINT_MAX) return false;
+	*value = result;
+	return true;
+}
+
+// Namespaces are numbered in order of appearance, 0 being our own
+struct NetnsTable {
+	// Owned, as config files come and go
+	char * names[FILTER_MAX_NETNS];
+	// -1 once no longer monitored, names are kept for events still on their way
+	int fds[FILTER_MAX_NETNS];
+	// Opened by the reload underway, released if it fails
+	bool opened[FILTER_MAX_NETNS];
+	size_t n;
+};
+
+static int lookupNetns(struct NetnsTable * table, char const * name, bool open_netns) {
+	if (name == NULL) return 0;
+	for (size_t i = 1; i < table->n; i++) {
+		if (strcmp(table->names[i], name) != 0) continue;
+		if (table->fds[i] >= 0 || !open_netns) return i;
+		if ((table->fds[i] = openNetns(name)) == -1) return -1;
+		table->opened[i] = true;
+		return i;
+	}
+	if (table->n == FILTER_MAX_NETNS) {
+		errno = ENOSPC;
+		return -1;
+	}
+	// Replays don't need the namespace to exist
+	int fd = open_netns ? openNetns(name) : -1;
+	if (open_netns && fd == -1) return -1;
+	table->names[table->n] = strdup(name);
+	if (table->names[table->n] == NULL) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	table->fds[table->n] = fd;
+	table->opened[table->n] = true;
+	return table->n++;
+}
+
+// The reload went through, what it opened stays
+static void keepNetns(struct NetnsTable * table) {
+	for (size_t i = 1; i < table->n; i++) table->opened[i] = false;
+}
+
+// Back to before the failed reload that started with n entries
+static void releaseNetns(struct NetnsTable * table, size_t n) {
+	for (size_t i = 1; i < table->n; i++) {
+		if (!table->opened[i]) continue;
+		table->opened[i] = false;
+		close(table->fds[i]);
+		table->fds[i] = -1;
+		if (i >= n) free(table->names[i]);
+	}
+	table->n = n;
+}
+
+// Close namespaces in neither filter, the second of which may be NULL
+static void closeUnusedNetns(struct NetnsTable * table, struct AddrFilter const * filter,
+                             struct AddrFilter const * other) {
+	for (size_t i = 1; i < table->n; i++) {
+		if (table->fds[i] < 0 || filterHasNetns(filter, i) || (other != NULL && filterHasNetns(other, i))) continue;
+		close(table->fds[i]);
+		table->fds[i] = -1;
+	}
+}
+
+static void closeNetns(struct NetnsTable * table) {
+	for (size_t i = 1; i < table->n; i++) {
+		if (table->fds[i] >= 0) close(table->fds[i]);
+		free(table->names[i]);
+	}
+	table->n = 1;
+}
+
+// Adds a comma-separated list of <interface>[@<netns>] to filter, saying what went wrong on stderr.
+// spec is split up in place.
+static int addIfaces(struct AddrFilter * filter, struct NetnsTable * table, char * spec, bool open_netns,
+                     bool verbose) {
+	char * iface_save;
+	for (char * iface_name = strtok_r(spec, ",", &iface_save);
+	     iface_name != NULL; iface_name = strtok_r(NULL, ",", &iface_save)) {
+		char * netns_name = strchr(iface_name, '@');
+		if (netns_name != NULL) *netns_name++ = '\0';
+		int const netns = lookupNetns(table, netns_name, open_netns);
+		if (netns < 0) {
+			fprintf(stderr, "Error opening network namespace %s: %s\n", netns_name, strerror(errno));
+			return -1;
+		}
+
+		// Names resolve in the interface's namespace
+		int saved_netns;
+		if (enterNetns(table->fds[netns], &saved_netns) != 0) {
+			fprintf(stderr, "Error entering network namespace %s: %s\n", netns_name, strerror(errno));
+			return -1;
+		}
+		unsigned int iface = if_nametoindex(iface_name);
+		int const resolve_errno = errno;
+		if (leaveNetns(saved_netns) != 0) {
+			perror("Error leaving network namespace");
+			return -1;
+		}
+		// Interfaces in a replay may not exist here, so allow them by index
+		if (iface == 0 && !parseUInt(iface_name, &iface)) iface = 0;
+		if (iface == 0) {
+			fprintf(stderr, "Error resolving interface %s: %s\n", iface_name, strerror(resolve_errno));
+			return -1;
+		}
+		if (filterAddIface(filter, netns, iface) < 0) {
+			fprintf(stderr, "Error adding interface %s: %s\n", iface_name, strerror(errno));
+			return -1;
+		}
+		if (verbose && netns_name != NULL) printf(" %s@%s (#%u)", iface_name, netns_name, iface);
+		else if (verbose) printf(" %s (#%u)", iface_name, iface);
+	}
+	return 0;
+}
+
+// A TSIG key file holds one [ALG:]NAME:SECRET line, keeping the secret out of ps
+static bool readKeyFile(char const * path, char * key, size_t size) {
+	FILE * file = fopen(path, "r");
+	if (file == NULL) return false;
+	bool result = fgets(key, size, file) != NULL;
+	fclose(file);
+	key[strcspn(key, "\r\n")] = '\0';
+	return result;
+}
+
+// Atomic rather than sig_atomic_t, as both threads read it when threaded
+static atomic_bool stop = false;
+static void handleStop(__attribute__((unused)) int sig) {
+	stop = 1;
+}
+
+// Rereads --config on SIGHUP
+struct Reloader {
+	char const * path;
+	// The signalfd
+	struct EpollData data;
+	struct NetnsTable * netns_table;
+	bool open_netns;
+	Updater_t updater;
+	// Unthreaded, the monitor is switched over directly, otherwise through handoff
+	Monitor_t monitor;
+	struct FilterHandoff * handoff;
+};
+
+// Passes a new filter to the monitor thread
+struct FilterHandoff {
+	// Also guards the namespace table
+	pthread_mutex_t lock;
+	struct AddrFilter filter;
+	struct NetnsTable * netns_table;
+	// The eventfd the monitor thread waits on
+	struct EpollData data;
+};
+
+// Mistakes in the file keep the running configuration, only failing syscalls are fatal
+static int reload(struct Reloader * reloader) {
+	struct signalfd_siginfo info;
+	if (read(reloader->data.fd, &info, sizeof(info)) == -1) return errno == EAGAIN ? 0 : -1;
+	printf("Reloading %s\n", reloader->path);
+
+	struct Config config;
+	if (loadConfig(&config, reloader->path) != 0) {
+		fputs("Keeping the running configuration\n", stderr);
+		return 0;
+	}
+	int result = 0;
+	struct AddrFilter filter = {
+		.allow_private = config.allow_private,
+		.allow_temporary = config.allow_temporary,
+		.ipv4 = config.ipv4,
+		.ipv6 = config.ipv6,
+	};
+	// The monitor thread closes namespaces it no longer needs, but not those about to be handed over
+	struct NetnsTable * table = reloader->netns_table;
+	if (reloader->handoff != NULL) pthread_mutex_lock(&reloader->handoff->lock);
+	size_t const n_netns = table->n;
+	for (size_t i = 0; i < config.n_ifaces; i++) {
+		if (addIfaces(&filter, reloader->netns_table, config.ifaces[i], reloader->open_netns, false) != 0) {
+			goto keep;
+		}
+	}
+	if (reloader->updater->tag == DNS_UPDATER && filter.n_ifaces > 1) {
+		fputs("--dns-server takes a single interface\n", stderr);
+		goto keep;
+	}
+	// Each kind of updater has its own options, which only the command line gives
+	bool const web = reloader->updater->tag == WEB_UPDATER;
+	if ((config.n_urls > 0) != web) {
+		fputs(web ? "Dropping all URLs needs a restart\n" : "Adding URLs needs a restart\n", stderr);
+		goto keep;
+	}
+	for (size_t i = 0; i < config.n_urls; i++) {
+		if (config.check_names[i] == NULL || reloader->updater->web.check.fd >= 0) continue;
+		fputs("Checking records needs a restart with --check-server\n", stderr);
+		goto keep;
+	}
+
+	// URLs first, a failure there leaves the monitor as it was
+	if (web && reconfigureWebUpdater(&reloader->updater->web, (char const * const *) config.urls,
+	                                 (char const * const *) config.check_names, config.n_urls, &filter) != 0) {
+		result = -1;
+	} else if (reloader->handoff == NULL) {
+		result = reconfigureMonitor(reloader->monitor, filter);
+		if (result == 0) closeUnusedNetns(table, &filter, NULL);
+	} else {
+		reloader->handoff->filter = filter;
+		uint64_t one = 1;
+		if (write(reloader->handoff->data.fd, &one, sizeof(one)) == -1) result = -1;
+	}
+	if (result == 0) keepNetns(table);
+	else releaseNetns(table, n_netns);
+	if (reloader->handoff != NULL) pthread_mutex_unlock(&reloader->handoff->lock);
+	destroyConfig(&config);
+	return result;
+
+keep:
+	releaseNetns(table, n_netns);
+	if (reloader->handoff != NULL) pthread_mutex_unlock(&reloader->handoff->lock);
+	fputs("Keeping the running configuration\n", stderr);
+	destroyConfig(&config);
+	return 0;
+}
+
+// On the monitor thread, picks up the latest filter reload() left
+static int takeFilter(struct FilterHandoff * handoff, Monitor_t monitor) {
+	uint64_t count;
+	if (read(handoff->data.fd, &count, sizeof(count)) == -1) return errno == EAGAIN ? 0 : -1;
+	pthread_mutex_lock(&handoff->lock);
+	struct AddrFilter const filter = handoff->filter;
+	pthread_mutex_unlock(&handoff->lock);
+	if (reconfigureMonitor(monitor, filter) != 0) return -1;
+	// A newer filter may already be waiting, whose namespaces stay open
+	pthread_mutex_lock(&handoff->lock);
+	closeUnusedNetns(handoff->netns_table, &filter, &handoff->filter);
+	pthread_mutex_unlock(&handoff->lock);
+	return 0;
+}
+
+// What one thread's event loop services. Unthreaded, that's everything.
+struct EventLoop {
+	int epoll_fd;
+	// Set by the web updater, NULL if nothing on this loop has timeouts
+	struct Deadline const * deadline;
+	Monitor_t monitor;
+	// The monitor is on io_uring
+	bool uring;
+	Replay_t replay;
+	Updater_t updater;
+	MetricsServer_t metrics;
+	// Replay done, or on the updater thread, the monitor thread is
+	bool done;
+};
+
+// Returns once stopped, or done and all updates are through
+static int runLoop(struct EventLoop * loop) {
+	do {
+		if (loop->done && updaterIdle(loop->updater) && !(loop->monitor && monitorHolding(loop->monitor))) break;
+
+		// Worked out afresh every time, so a busy loop doesn't keep pushing the deadline back
+		struct timespec now;
+		int timeout = -1;
+		if (loop->deadline && loop->deadline->set) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout = timespecUntilMs(now, loop->deadline->at);
+		}
+
+		struct epoll_event events[16];
+		int nevents = epoll_wait(loop->epoll_fd, events, NELEMS(events), timeout);
+		if (stop) {
+			break;
+		} else if (nevents < 0 && errno == EINTR) {
+			// io_uring posts completions by interrupting the wait, so they're there already
+			if (loop->uring && processUring(loop->monitor, -1, 0) != 0) {
+				perror("Error processing message");
+				return -1;
+			}
+			continue;
+		} else if (nevents < 0) {
+			perror("Error waiting for events");
+			return -1;
+		}
+
+		if (loop->deadline && loop->deadline->set) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (!timespecBefore(now, loop->deadline->at) && handleTimeout(loop->updater) != 0) {
+				return -1;
+			}
+		}
+
+		for (int i = 0; i < nevents; i++) {
+			struct EpollData * data = events[i].data.ptr;
+
+			switch (data->tag) {
+			case EPOLL_MONITOR:
+				if (processMessage(loop->monitor, data->fd, events[i].events) != 0) {
+					perror("Error processing message");
+					return -1;
+				}
+				break;
+			case EPOLL_MONITOR_TIMER:
+				if (processTimeout(loop->monitor, data->fd, events[i].events) != 0) {
+					perror("Error processing settled addresses");
+					return -1;
+				}
+				break;
+			case EPOLL_MONITOR_URING:
+				if (processUring(loop->monitor, data->fd, events[i].events) != 0) {
+					perror("Error processing message");
+					return -1;
+				}
+				break;
+			case EPOLL_REPLAY: {
+				int result = processReplay(loop->replay, data->fd, events[i].events);
+				if (result < 0) {
+					perror("Error replaying recording");
+					return -1;
+				} else if (result > 0) {
+					printf("Replayed %llu datagrams.\n", replayCount(loop->replay));
+					loop->done = true;
+				}
+				break;
+			}
+			case EPOLL_METRICS:
+				if (processMetrics(loop->metrics, data->fd, events[i].events) != 0) {
+					perror("Error serving metrics");
+					return -1;
+				}
+				break;
+			case EPOLL_WEB_UPDATER:
+			case EPOLL_DNS_UPDATER:
+			case EPOLL_EXEC_UPDATER:
+				if (handleMessage(loop->updater, data->fd, events[i].events) != 0) {
+					perror("Error processing update");
+					return -1;
+				}
+				break;
+			case EPOLL_QUEUE: {
+				int result = drainQueue(data->queue, loop->updater);
+				if (result < 0) {
+					perror("Error processing update");
+					return -1;
+				} else if (result > 0) {
+					// The monitor thread already said what went wrong
+					if (atomic_load(&data->queue->result) != 0) return -1;
+					loop->done = true;
+				}
+				break;
+			}
+			case EPOLL_SIGNAL:
+				if (reload(data->reloader) != 0) {
+					perror("Error reloading configuration");
+					return -1;
+				}
+				break;
+			case EPOLL_RECONFIGURE:
+				if (takeFilter(data->handoff, loop->monitor) != 0) {
+					perror("Error reconfiguring monitor");
+					return -1;
+				}
+				break;
+			case EPOLL_STOP:
+				return 0;
+			}
+		}
+
+		// One write for everything the batch printed
+		if (flushUpdater(loop->updater) != 0) {
+			perror("Error writing output");
+			return -1;
+		}
+	} while (true);
+	return 0;
+}
+
+static void * runMonitorThread(void * arg) {
+	struct EventLoop * loop = arg;
+	int result = runLoop(loop);
+	// Lets the updater thread finish off, or bail out too
+	if (closeQueue(loop->updater->queue.queue, result) != 0) perror("Error stopping monitor thread");
+	return NULL;
 }
 
 int main(int const argc, char** argv) {
 	struct AddrFilter filter = {.allow_private = false};
+	struct MonitorOptions monitor_options = {
+		.kernel_filter = true,
+		.settle_ms = 0,
+		.max_delay_ms = 10000,
+	};
+	char hostname[HOST_NAME_MAX + 1] = "";
+	char const * record_path = NULL;
+	char const * replay_path = NULL;
+	bool replay_realtime = false;
+	struct NetnsTable netns_table = {.fds = {-1}, .n = 1};
+	Replay_t replay = NULL;
+	char const * metrics_listen = NULL;
+	MetricsServer_t metrics = NULL;
+	struct WebUpdaterOptions web_options = {
+		.verbose = false,
+		.hostname = NULL,
+		.max_retries = 5,
+		.retry_base_ms = 1000,
+		.retry_max_ms = 60000,
+		// One dual-stack change at once
+		.rate_burst = 2,
+		.rate_interval_ms = 0,
+	};
+	struct DnsUpdaterOptions dns_options = {
+		.ttl = 60,
+	};
+	struct PrintUpdaterOptions print_options = {
+		.json = false,
+		.fd = STDOUT_FILENO,
+	};
+	struct ExecUpdaterOptions exec_options = {0};
+	char tsig_key[512];
 	Updater_t updater;
 
 	// Deal with options
@@ -41,10 +486,47 @@ int main(int const argc, char** argv) {
 		{"verbose", no_argument, 0, 'v'},
 		{"version", no_argument, 0, 'V'},
 		{"help", no_argument, 0, 'h'},
+		{"no-kernel-filter", no_argument, 0, 'K'},
+		{"settle", required_argument, 0, 'S'},
+		{"max-delay", required_argument, 0, 'D'},
+		{"retries", required_argument, 0, 'R'},
+		{"retry-base", required_argument, 0, 'B'},
+		{"retry-max", required_argument, 0, 'M'},
+		{"rate-interval", required_argument, 0, 'I'},
+		{"rate-burst", required_argument, 0, 'b'},
+		{"preconnect", no_argument, 0, 'c'},
+		{"check-server", required_argument, 0, 'e'},
+		{"check-name", required_argument, 0, 'E'},
+		{"hostname", required_argument, 0, 'H'},
+		{"record", required_argument, 0, 'r'},
+		{"replay", required_argument, 0, 'P'},
+		{"replay-realtime", no_argument, 0, 'T'},
+		{"state", required_argument, 0, 'F'},
+		{"combined", no_argument, 0, 'C'},
+		{"dns-server", required_argument, 0, 'n'},
+		{"dns-zone", required_argument, 0, 'z'},
+		{"dns-name", required_argument, 0, 'N'},
+		{"dns-ttl", required_argument, 0, 'L'},
+		{"tsig-key", required_argument, 0, 'y'},
+		{"tsig-key-file", required_argument, 0, 'k'},
+		{"metrics", required_argument, 0, 'm'},
+		{"json", no_argument, 0, 'j'},
+		{"exec", required_argument, 0, 'x'},
+		{"threaded", no_argument, 0, 'X'},
+		{"io-uring", no_argument, 0, 'U'},
+		{"config", required_argument, 0, 'f'},
+		{0, 0, 0, 0},
 	};
 	bool verbosity = 0;
 	int opt_index = 0;
-	int epoll_timeout = -1;
+	struct Deadline deadline = {.set = false};
+	bool threaded = false;
+	char const * config_path = NULL;
+	struct Config config = {.n_ifaces = 0};
+	// One per URL in order, NULL for URLs not checked
+	char const * check_names[CONFIG_MAX_URLS] = {NULL};
+	size_t n_check_names = 0;
+	int exit_status = EXIT_FAILURE;
 	int opt;
 
 	while ((opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index)) != -1) {
@@ -67,6 +549,125 @@ int main(int const argc, char** argv) {
 		case 't':
 			filter.allow_temporary = true;
 			break;
+		case 'K':
+			monitor_options.kernel_filter = false;
+			break;
+		case 'S':
+			if (!parseUInt(optarg, &monitor_options.settle_ms)) {
+				fprintf(stderr, "Invalid settle time: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'D':
+			if (!parseUInt(optarg, &monitor_options.max_delay_ms)) {
+				fprintf(stderr, "Invalid max delay: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'R':
+			if (!parseUInt(optarg, &web_options.max_retries)) {
+				fprintf(stderr, "Invalid retry count: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'B':
+			if (!parseUInt(optarg, &web_options.retry_base_ms) || web_options.retry_base_ms == 0) {
+				fprintf(stderr, "Invalid retry delay: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'M':
+			if (!parseUInt(optarg, &web_options.retry_max_ms) || web_options.retry_max_ms == 0) {
+				fprintf(stderr, "Invalid retry delay: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'I':
+			if (!parseUInt(optarg, &web_options.rate_interval_ms)) {
+				fprintf(stderr, "Invalid rate interval: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'b':
+			if (!parseUInt(optarg, &web_options.rate_burst) || web_options.rate_burst == 0) {
+				fprintf(stderr, "Invalid rate burst: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'c':
+			web_options.preconnect = true;
+			break;
+		case 'e':
+			web_options.check_server = optarg;
+			break;
+		case 'E':
+			if (n_check_names == NELEMS(check_names)) {
+				fprintf(stderr, "At most %zu --check-name\n", NELEMS(check_names));
+				return EXIT_USAGE;
+			}
+			check_names[n_check_names++] = strcmp(optarg, "-") == 0 ? NULL : optarg;
+			break;
+		case 'H':
+			web_options.hostname = optarg;
+			break;
+		case 'r':
+			record_path = optarg;
+			break;
+		case 'P':
+			replay_path = optarg;
+			break;
+		case 'T':
+			replay_realtime = true;
+			break;
+		case 'F':
+			web_options.state_path = optarg;
+			break;
+		case 'C':
+			monitor_options.combine_families = true;
+			break;
+		case 'n':
+			dns_options.server = optarg;
+			break;
+		case 'z':
+			dns_options.zone = optarg;
+			break;
+		case 'N':
+			dns_options.name = optarg;
+			break;
+		case 'L':
+			if (!parseUInt(optarg, &dns_options.ttl) || dns_options.ttl > INT32_MAX) {
+				fprintf(stderr, "Invalid TTL: %s\n", optarg);
+				return EXIT_USAGE;
+			}
+			break;
+		case 'y':
+			dns_options.tsig_key = optarg;
+			break;
+		case 'k':
+			if (!readKeyFile(optarg, tsig_key, sizeof(tsig_key))) {
+				fprintf(stderr, "Couldn't read TSIG key %s: %s\n", optarg, strerror(errno));
+				return EXIT_FAILURE;
+			}
+			dns_options.tsig_key = tsig_key;
+			break;
+		case 'm':
+			metrics_listen = optarg;
+			break;
+		case 'j':
+			print_options.json = true;
+			break;
+		case 'x':
+			exec_options.command = optarg;
+			break;
+		case 'X':
+			threaded = true;
+			break;
+		case 'U':
+			monitor_options.io_uring = true;
+			break;
+		case 'f':
+			config_path = optarg;
+			break;
 		case 'h':
 			printUsage();
 			return EXIT_SUCCESS;
@@ -76,40 +677,123 @@ int main(int const argc, char** argv) {
 		}
 	}
 
+	if (config_path != NULL
+	    && (optind < argc || filter.ipv4 || filter.ipv6 || filter.allow_private || filter.allow_temporary)) {
+		fputs("With --config, interfaces, URLs, -4, -6, -p and -t go in the config file\n", stderr);
+		return EXIT_USAGE;
+	}
+
 	// Listen for all changes if none specified.
 	if (!(filter.ipv6 || filter.ipv4)) {
 		filter.ipv6 = true;
 		filter.ipv4 = true;
 	}
 
+	if (record_path != NULL && replay_path != NULL) {
+		fputs("Can't record and replay at the same time\n", stderr);
+		return EXIT_USAGE;
+	}
+	monitor_options.replay = replay_path != NULL;
+	if (dns_options.server != NULL && dns_options.zone == NULL) {
+		fputs("--dns-server needs --dns-zone\n", stderr);
+		return EXIT_USAGE;
+	}
+
+	// Keep stdout for JSON, everything else goes to stderr
+	if (print_options.json) {
+		print_options.fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+		if (print_options.fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+			perror("Couldn't set up JSON output");
+			return EXIT_FAILURE;
+		}
+	}
+
 	if (verbosity){
 		puts("Running in verbose mode.");
 	}
+	web_options.verbose = verbosity;
+	if (web_options.hostname == NULL) {
+		if (gethostname(hostname, sizeof(hostname) - 1) != 0) {
+			perror("Couldn't get hostname");
+			return EXIT_FAILURE;
+		}
+		web_options.hostname = hostname;
+	}
+	dns_options.verbose = verbosity;
+	dns_options.hostname = web_options.hostname;
+	dns_options.max_retries = web_options.max_retries;
+	dns_options.retry_base_ms = web_options.retry_base_ms;
+	dns_options.retry_max_ms = web_options.retry_max_ms;
+	exec_options.verbose = verbosity;
+	exec_options.retry_base_ms = web_options.retry_base_ms;
+	exec_options.retry_max_ms = web_options.retry_max_ms;
+
+	// Interfaces and URLs come from one or the other
+	char * const * iface_specs = &argv[optind];
+	size_t n_iface_specs = 1;
+	char const * const * urls = (char const * const *) &argv[optind + 1];
+	int n_urls = argc - optind - 1;
+	if (config_path != NULL) {
+		if (loadConfig(&config, config_path) != 0) return EXIT_FAILURE;
+		filter.ipv4 = config.ipv4;
+		filter.ipv6 = config.ipv6;
+		filter.allow_private = config.allow_private;
+		filter.allow_temporary = config.allow_temporary;
+		iface_specs = config.ifaces;
+		n_iface_specs = config.n_ifaces;
+		urls = (char const * const *) config.urls;
+		n_urls = config.n_urls;
+	} else if (n_urls < 0) {
+		// No interface, so nothing else given is worth checking
+		puts("Usage:\n");
+		printUsage();
+		return EXIT_USAGE;
+	}
+	char const * const * url_checks = config_path != NULL ? (char const * const *) config.check_names : check_names;
+	bool checked = false;
+	for (int i = 0; i < n_urls && i < CONFIG_MAX_URLS; i++) checked |= url_checks[i] != NULL;
+	if (config_path != NULL && n_check_names > 0) {
+		fputs("With --config, check names go on its url lines\n", stderr);
+		destroyConfig(&config);
+		return EXIT_USAGE;
+	} else if ((int) n_check_names > n_urls || (n_check_names > 0 && n_urls > CONFIG_MAX_URLS)) {
+		fprintf(stderr, "--check-name is given once for each of the first %d URLs at most\n", CONFIG_MAX_URLS);
+		return EXIT_USAGE;
+	} else if (checked != (web_options.check_server != NULL)) {
+		fputs("--check-server and check names go together\n", stderr);
+		destroyConfig(&config);
+		return EXIT_USAGE;
+	}
 
 	// Prepare updater, cleanup necessary if exiting after this point.
 	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (epoll_fd < 0) {
 		perror("Couldn't create epoll");
+		destroyConfig(&config);
 		return EXIT_FAILURE;
 	}
 
-	switch ((argc - optind)){
-	case 1:
-		updater = createPrintUpdater();
-		puts("Printing addresses to stdout.");
-		break;
-	case 2:
-		updater = createWebUpdater(
-			argv[optind + 1], epoll_fd, &epoll_timeout, (struct WebUpdaterOptions) { .verbose = verbosity }
-		);
-		printf("Updating URL %s with addresses.", argv[optind + 1]);
-		puts("");
-		break;
-	default:
-		puts("Usage:\n");
-		printUsage();
-		close(epoll_fd);
-		return EXIT_USAGE;
+	if ((dns_options.server != NULL) + (exec_options.command != NULL) + (n_urls > 0) > 1) {
+		fputs("Only one of URLs, --dns-server and --exec can be used\n", stderr);
+		exit_status = EXIT_USAGE;
+		goto cleanup_epoll;
+	} else if (exec_options.command != NULL) {
+		updater = createExecUpdater(epoll_fd, exec_options);
+		printf("Sending addresses to %s.\n", exec_options.command);
+	} else if (dns_options.server != NULL) {
+		updater = createDnsUpdater(epoll_fd, dns_options);
+		printf("Updating DNS on %s in zone %s.\n", dns_options.server, dns_options.zone);
+		explicit_bzero(tsig_key, sizeof(tsig_key));
+	} else if (n_urls == 0) {
+		updater = createPrintUpdater(print_options);
+		puts(print_options.json ? "Printing addresses to stdout as JSON." : "Printing addresses to stdout.");
+	} else {
+		updater = createWebUpdater(urls, n_urls <= CONFIG_MAX_URLS ? url_checks : NULL, n_urls, epoll_fd, &deadline,
+		                           web_options);
+		for (int i = 0; i < n_urls; i++) {
+			printf("Updating URL %s with addresses.", urls[i]);
+			puts("");
+		}
 	}
 
 	if (updater == NULL) {
@@ -117,70 +801,220 @@ int main(int const argc, char** argv) {
 		goto cleanup_epoll;
 	}
 
-	char const * const iface_name = argv[optind];
-	filter.iface = if_nametoindex(iface_name);
-	if (filter.iface == 0) {
-		fprintf(stderr, "Error resolving interface %s: %s\n", iface_name, strerror(errno));
-		goto cleanup_updater;
+	if (verbosity){
+		fputs("Listening on interfaces:", stdout);
+	}
+	for (size_t i = 0; i < n_iface_specs; i++) {
+		if (addIfaces(&filter, &netns_table, iface_specs[i], !monitor_options.replay, verbosity) != 0) {
+			goto cleanup_netns;
+		}
+	}
+	keepNetns(&netns_table);
+	// Reloads read the file afresh
+	destroyConfig(&config);
+	monitor_options.netns_fds = netns_table.fds;
+	monitor_options.netns_names = (char const * const *) netns_table.names;
+	if (filter.n_ifaces == 0) {
+		fputs("No interface specified\n", stderr);
+		goto cleanup_netns;
+	}
+	// Every interface would write the same records
+	if (updater->tag == DNS_UPDATER && filter.n_ifaces > 1) {
+		fputs("--dns-server takes a single interface\n", stderr);
+		goto cleanup_netns;
 	}
 
 	if (verbosity){
-		printf("Listening on interfaces: %s (#%d)\n", iface_name, filter.iface);
+		puts("");
 		fputs("Listening for address changes in:", stdout);
 		if (filter.ipv4) printf(" IPv4");
 		if (filter.ipv6) printf(" IPv6");
 		puts("");
 	}
 
-	Monitor_t monitor = createMonitor(filter, 1024, epoll_fd, updater);
+	// No SA_RESTART, so epoll_wait returns and we can shut down cleanly
+	struct sigaction stop_action = {.sa_handler = handleStop};
+	sigaction(SIGINT, &stop_action, NULL);
+	sigaction(SIGTERM, &stop_action, NULL);
+
+	if (record_path != NULL) {
+		monitor_options.record = openRecording(record_path);
+		if (monitor_options.record == NULL) {
+			fprintf(stderr, "Couldn't open recording %s: %s\n", record_path, strerror(errno));
+			goto cleanup_netns;
+		}
+	}
+
+	// Threaded, the monitor gets its own thread and epoll, and passes changes on
+	// through a queue so draining netlink never waits on updates
+	int monitor_epoll_fd = epoll_fd;
+	Updater_t monitor_updater = updater;
+	struct EventQueue queue = {.event_fd = -1};
+	struct EpollData queue_data = {.tag = EPOLL_QUEUE, .queue = &queue};
+	int stop_fd = -1;
+	struct EpollData stop_data = {.tag = EPOLL_STOP};
+	pthread_t monitor_thread;
+	bool thread_started = false;
+	struct Reloader reloader = {
+		.path = config_path,
+		.data = {.tag = EPOLL_SIGNAL, .fd = -1},
+		.netns_table = &netns_table,
+		.open_netns = !monitor_options.replay,
+		.updater = updater,
+	};
+	struct FilterHandoff handoff = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.netns_table = &netns_table,
+		.data = {.tag = EPOLL_RECONFIGURE, .fd = -1},
+	};
+	if (threaded) {
+		monitor_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (monitor_epoll_fd < 0 || createQueue(&queue) != 0
+		    || (monitor_updater = createQueueUpdater(&queue)) == NULL
+		    || (stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+			perror("Couldn't set up monitor thread");
+			goto cleanup_threads;
+		}
+		queue_data.fd = queue.event_fd;
+		stop_data.fd = stop_fd;
+		struct epoll_event queue_event = {.events = EPOLLIN, .data = {.ptr = &queue_data}};
+		struct epoll_event stop_event = {.events = EPOLLIN, .data = {.ptr = &stop_data}};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, queue.event_fd, &queue_event) == -1
+		    || epoll_ctl(monitor_epoll_fd, EPOLL_CTL_ADD, stop_fd, &stop_event) == -1) {
+			perror("Couldn't set up monitor thread");
+			goto cleanup_threads;
+		}
+	}
+
+	Monitor_t monitor = createMonitor(filter, 1024, monitor_epoll_fd, monitor_updater, monitor_options);
 	if (monitor == NULL) {
 		perror("Couldn't set up monitoring");
-		goto cleanup;
+		goto cleanup_threads;
 	}
 
-#ifdef WITH_SYSTEMD
-	sd_notify(0, "READY=1");
-#endif
+	if (replay_path != NULL) {
+		replay = createReplay(replay_path, replay_realtime, monitor_epoll_fd, monitor);
+		if (replay == NULL) {
+			fprintf(stderr, "Couldn't open recording %s: %s\n", replay_path, strerror(errno));
+			goto cleanup;
+		}
+	}
 
-	// Main loop
-	do {
-		struct epoll_event events[2];
-		int nevents = epoll_wait(epoll_fd, events, NELEMS(events), epoll_timeout);
-		if (nevents < 0) {
-			perror("Error waiting for events");
+	// Threaded, monitor counters are read from the updater thread while the monitor thread counts on
+	if (metrics_listen != NULL) {
+		metrics = createMetricsServer(metrics_listen, epoll_fd, monitor, updater);
+		if (metrics == NULL) {
+			fprintf(stderr, "Couldn't serve metrics on %s: %s\n", metrics_listen, strerror(errno));
+			goto cleanup;
+		}
+	}
+
+	// With --config, SIGHUP is read from a signalfd on this thread's loop. Blocked before the monitor
+	// thread starts, so that it inherits the mask.
+	if (config_path != NULL) {
+		sigset_t hangup;
+		sigemptyset(&hangup);
+		sigaddset(&hangup, SIGHUP);
+		if (sigprocmask(SIG_BLOCK, &hangup, NULL) != 0
+		    || (reloader.data.fd = signalfd(-1, &hangup, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+			perror("Couldn't set up reloading");
+			goto cleanup;
+		}
+		reloader.data.reloader = &reloader;
+		struct epoll_event signal_event = {.events = EPOLLIN, .data = {.ptr = &reloader.data}};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reloader.data.fd, &signal_event) == -1) {
+			perror("Couldn't set up reloading");
 			goto cleanup;
-		} else if (nevents == 0) {
-			if (handleTimeout(updater) != 0) {
+		}
+		if (!threaded) {
+			reloader.monitor = monitor;
+		} else {
+			handoff.data.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			handoff.data.handoff = &handoff;
+			struct epoll_event handoff_event = {.events = EPOLLIN, .data = {.ptr = &handoff.data}};
+			if (handoff.data.fd == -1
+			    || epoll_ctl(monitor_epoll_fd, EPOLL_CTL_ADD, handoff.data.fd, &handoff_event) == -1) {
+				perror("Couldn't set up reloading");
 				goto cleanup;
 			}
+			reloader.handoff = &handoff;
 		}
+	}
 
-		for (int i = 0; i < nevents; i++) {
-			// Could pull the monitor/updater out of the epoll event, but we only have one so...
-			struct EpollData * data = events[i].data.ptr;
-
-			switch (data->tag) {
-			case EPOLL_MONITOR:
-				if (processMessage(monitor, data->fd, events[i].events) != 0) {
-					perror("Error processing message");
-					goto cleanup;
-				}
-				break;
-			case EPOLL_WEB_UPDATER:
-				if (handleMessage(updater, data->fd, events[i].events) != 0) {
-					perror("Error processing update");
-					goto cleanup;
-				}
-				break;
-			}
+	struct EventLoop loop = {
+		.epoll_fd = epoll_fd,
+		.deadline = &deadline,
+		.updater = updater,
+		.metrics = metrics,
+	};
+	struct EventLoop monitor_loop = {
+		.epoll_fd = monitor_epoll_fd,
+		.monitor = monitor,
+		.uring = monitor_options.io_uring,
+		.replay = replay,
+		.updater = monitor_updater,
+	};
+	if (!threaded) {
+		loop.monitor = monitor;
+		loop.uring = monitor_options.io_uring;
+		loop.replay = replay;
+	} else {
+		// Signals go to this thread, which stops the other
+		sigset_t signals, saved_signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &signals, &saved_signals);
+		errno = pthread_create(&monitor_thread, NULL, runMonitorThread, &monitor_loop);
+		pthread_sigmask(SIG_SETMASK, &saved_signals, NULL);
+		if (errno != 0) {
+			perror("Couldn't start monitor thread");
+			goto cleanup;
 		}
-	} while (true);
+		thread_started = true;
+	}
+
+#ifdef WITH_SYSTEMD
+	sd_notify(0, "READY=1");
+#endif
+
+	if (runLoop(&loop) == 0) exit_status = EXIT_SUCCESS;
+
+	if (flushUpdater(updater) != 0) perror("Error writing output");
 
 cleanup:
+	if (thread_started) {
+		uint64_t one = 1;
+		if (write(stop_fd, &one, sizeof(one)) == -1) perror("Error stopping monitor thread");
+		pthread_join(monitor_thread, NULL);
+	}
+	if (verbosity && exit_status == EXIT_SUCCESS) {
+		struct MonitorStats stats = monitorStats(monitor);
+		printf("Address messages delivered by kernel: %llu, rejected in userspace: %llu\n",
+		       stats.delivered, stats.rejected);
+		printf("Receive syscalls: %llu\n", stats.syscalls);
+		if (stats.dump_us >= 0) {
+			printf("Initial dump (%s) took %lld us\n", stats.strict_dump ? "per interface" : "all interfaces",
+			       stats.dump_us);
+		}
+		if (stats.first_update_us >= 0) printf("First update %lld us after start\n", stats.first_update_us);
+	}
+	if (metrics != NULL) destroyMetricsServer(metrics);
+	if (replay != NULL) destroyReplay(replay);
 	destroyMonitor(monitor);
-cleanup_updater:
+cleanup_threads:
+	if (reloader.data.fd >= 0) close(reloader.data.fd);
+	if (handoff.data.fd >= 0) close(handoff.data.fd);
+	if (stop_fd >= 0) close(stop_fd);
+	if (monitor_updater != updater && monitor_updater != NULL) destroyUpdater(monitor_updater);
+	destroyQueue(&queue);
+	if (monitor_epoll_fd >= 0 && monitor_epoll_fd != epoll_fd) close(monitor_epoll_fd);
+	if (monitor_options.record != NULL) fclose(monitor_options.record);
+cleanup_netns:
+	closeNetns(&netns_table);
 	destroyUpdater(updater);
 cleanup_epoll:
+	destroyConfig(&config);
 	close(epoll_fd);
-	return EXIT_FAILURE;
+	return exit_status;
 }
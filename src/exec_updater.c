@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include "exec_updater.h"
+#include "timespec.h"
+#include "util.h"
+
+extern char ** environ;
+
+// The EpollData live as long as the updater, as a helper's pipes may still
+// have events waiting in the main loop when it dies
+static int addEpoll(struct ExecUpdater * updater, int fd, uint32_t events, struct EpollData * data) {
+	data->fd = fd;
+	struct epoll_event event = {
+		.events = events,
+		.data = { .ptr = data },
+	};
+	return epoll_ctl(updater->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void closeEpoll(struct ExecUpdater * updater, int * fd, struct EpollData * data) {
+	if (*fd >= 0) {
+		epoll_ctl(updater->epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+		close(*fd);
+	}
+	*fd = -1;
+	if (data != NULL) data->fd = -1;
+}
+
+static struct EpollData * createEpollData(struct ExecUpdater * updater) {
+	struct EpollData * data = malloc(sizeof(*data));
+	if (data == NULL) return NULL;
+	data->tag = EPOLL_EXEC_UPDATER;
+	data->fd = -1;
+	data->exec_updater = updater;
+	return data;
+}
+
+// One line per event: id, interface, address/prefixlen, then the latest IPv4
+// and IPv6 addresses of the interface, - if there is none
+static size_t formatEvent(struct ExecEvent const * pending, char * line) {
+	struct AddrEvent const * event = &pending->event;
+	char * p = line + sprintf(line, "%llu %s ", pending->id, event->iface);
+	p += formatAddr(&event->addr, p);
+	p += sprintf(p, "/%u ", event->addr.prefixlen);
+	struct IPAddr const * latest[] = {&event->ipv4, &event->ipv6};
+	for (size_t i = 0; i < NELEMS(latest); i++) {
+		if (latest[i]->af == AF_UNSPEC) *p++ = '-';
+		p += formatAddr(latest[i], p);
+		*p++ = i + 1 < NELEMS(latest) ? ' ' : '\n';
+	}
+	return p - line;
+}
+
+static int blockInput(struct ExecUpdater * updater, bool blocked) {
+	if (updater->in_blocked == blocked) return 0;
+	updater->in_blocked = blocked;
+	struct epoll_event event = {
+		.events = blocked ? EPOLLOUT : 0,
+		.data = { .ptr = updater->in_data },
+	};
+	return epoll_ctl(updater->epoll_fd, EPOLL_CTL_MOD, updater->in_fd, &event);
+}
+
+// Each event is a single write, atomic as lines are shorter than PIPE_BUF
+static int sendPending(struct ExecUpdater * updater) {
+	if (updater->pid == -1) return 0;
+	for (size_t i = 0; i < updater->n_pending; i++) {
+		struct ExecEvent * pending = &updater->pending[i];
+		if (pending->sent) continue;
+		char line[EXEC_MAX_LINE];
+		size_t len = formatEvent(pending, line);
+		if (write(updater->in_fd, line, len) == -1) {
+			if (errno == EAGAIN) return blockInput(updater, true);
+			// Going away, noticed when its stdout closes
+			if (errno == EPIPE) return 0;
+			return -1;
+		}
+		pending->sent = true;
+		if (updater->options.verbose) printf("Sent to helper: %.*s", (int) len, line);
+	}
+	return blockInput(updater, false);
+}
+
+static int startHelper(struct ExecUpdater * updater) {
+	int in[2] = {-1, -1};
+	int out[2] = {-1, -1};
+	if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1) goto cleanup;
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	// We ignore SIGPIPE, the helper shouldn't
+	sigset_t defaults;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	// Nor signals we block, such as SIGHUP with --config
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+	char * const argv[] = {"sh", "-c", (char *) updater->options.command, NULL};
+	int error = posix_spawn(&updater->pid, "/bin/sh", &actions, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (error != 0) {
+		updater->pid = -1;
+		errno = error;
+		goto cleanup;
+	}
+	close(in[0]);
+	close(out[1]);
+	updater->in_fd = in[1];
+	updater->out_fd = out[0];
+	if (updater->options.verbose) printf("Started helper (pid %d)\n", (int) updater->pid);
+
+	if (fcntl(updater->in_fd, F_SETFL, O_NONBLOCK) == -1) return -1;
+	if (fcntl(updater->out_fd, F_SETFL, O_NONBLOCK) == -1) return -1;
+	if (addEpoll(updater, updater->out_fd, EPOLLIN, updater->out_data) == -1) return -1;
+	// Errors (the helper closed its stdin) are reported regardless
+	updater->in_blocked = false;
+	if (addEpoll(updater, updater->in_fd, 0, updater->in_data) == -1) return -1;
+	updater->line_len = 0;
+	updater->line_skip = false;
+
+	// The last helper may not have seen these
+	for (size_t i = 0; i < updater->n_pending; i++) {
+		if (updater->pending[i].sent) updater->stats.retried++;
+		updater->pending[i].sent = false;
+	}
+	return sendPending(updater);
+
+cleanup:
+	for (size_t i = 0; i < 2; i++) {
+		if (in[i] >= 0) close(in[i]);
+		if (out[i] >= 0) close(out[i]);
+	}
+	return -1;
+}
+
+// Reaps pid, polling for up to timeout_ms. Returns 0 once reaped, 1 if still running.
+static int reapHelper(pid_t pid, int * status, unsigned int timeout_ms) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct timespec const deadline = timespecAddMs(now, timeout_ms);
+	for (;;) {
+		pid_t const result = waitpid(pid, status, WNOHANG);
+		if (result == pid) return 0;
+		if (result == -1 && errno != EINTR) return -1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!timespecBefore(now, deadline)) return 1;
+		struct timespec const poll = {.tv_nsec = EXEC_STOP_POLL_MS * 1000000L};
+		nanosleep(&poll, NULL);
+	}
+}
+
+static void stopHelper(struct ExecUpdater * updater, int sig) {
+	closeEpoll(updater, &updater->in_fd, updater->in_data);
+	closeEpoll(updater, &updater->out_fd, updater->out_data);
+	if (updater->pid == -1) return;
+
+	int status;
+	int result = reapHelper(updater->pid, &status, 0);
+	if (result == 1) {
+		kill(updater->pid, sig);
+		// A helper ignoring SIGTERM mustn't hold up shutdown
+		if (sig != SIGKILL) result = reapHelper(updater->pid, &status, EXEC_STOP_MS);
+		if (result == 1) {
+			if (sig != SIGKILL) printf("Helper still running after %d ms, killing it\n", EXEC_STOP_MS);
+			kill(updater->pid, SIGKILL);
+			while ((result = waitpid(updater->pid, &status, 0)) == -1 && errno == EINTR);
+			if (result == updater->pid) result = 0;
+		}
+	}
+	if (result != 0) perror("Error waiting for helper");
+	else if (WIFSIGNALED(status)) printf("Helper killed by signal %d\n", WTERMSIG(status));
+	else printf("Helper exited with status %d\n", WEXITSTATUS(status));
+	updater->pid = -1;
+}
+
+static int scheduleRestart(struct ExecUpdater * updater) {
+	unsigned long long delay = updater->options.retry_base_ms;
+	for (unsigned int i = 0; i < updater->restarts && delay < updater->options.retry_max_ms; i++) delay *= 2;
+	if (delay > updater->options.retry_max_ms) delay = updater->options.retry_max_ms;
+	updater->restarts++;
+	printf("Restarting helper in %llu ms\n", delay);
+
+	struct itimerspec timer = {
+		.it_value = {
+			.tv_sec = delay / 1000,
+			.tv_nsec = delay % 1000 * 1000000,
+		},
+	};
+	return timerfd_settime(updater->timer_fd, 0, &timer, NULL);
+}
+
+// Lost its stdin or stdout, so can't be talked to any more
+static int helperDied(struct ExecUpdater * updater) {
+	stopHelper(updater, SIGKILL);
+	return scheduleRestart(updater);
+}
+
+Updater_t createExecUpdater(int epoll_fd, struct ExecUpdaterOptions options) {
+	Updater_t data = malloc(sizeof(*data));
+	if (data == NULL) return NULL;
+	data->tag = EXEC_UPDATER;
+	struct ExecUpdater * updater = &data->exec;
+	memset(updater, 0, sizeof(*updater));
+	updater->options = options;
+	updater->epoll_fd = epoll_fd;
+	updater->pid = -1;
+	updater->in_fd = -1;
+	updater->out_fd = -1;
+	updater->timer_fd = -1;
+
+	// Writing to a helper that died fails with EPIPE instead
+	struct sigaction ignore = {.sa_handler = SIG_IGN};
+	if (sigaction(SIGPIPE, &ignore, NULL) == -1) goto cleanup;
+
+	if ((updater->in_data = createEpollData(updater)) == NULL) goto cleanup;
+	if ((updater->out_data = createEpollData(updater)) == NULL) goto cleanup;
+	if ((updater->timer_data = createEpollData(updater)) == NULL) goto cleanup;
+
+	updater->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (updater->timer_fd == -1) goto cleanup;
+	if (addEpoll(updater, updater->timer_fd, EPOLLIN, updater->timer_data) == -1) goto cleanup;
+	if (startHelper(updater) != 0) goto cleanup;
+
+	return data;
+
+cleanup:
+	destroyExecUpdater(updater);
+	free(data);
+	return NULL;
+}
+
+void destroyExecUpdater(struct ExecUpdater * updater) {
+	// Closing its stdin first lets a well-behaved helper finish up
+	closeEpoll(updater, &updater->in_fd, updater->in_data);
+	stopHelper(updater, SIGTERM);
+	closeEpoll(updater, &updater->timer_fd, updater->timer_data);
+	free(updater->in_data);
+	free(updater->out_data);
+	free(updater->timer_data);
+}
+
+static void processAck(struct ExecUpdater * updater, char const * line) {
+	char * status;
+	unsigned long long id = strtoull(line, &status, 10);
+	status += strspn(status, " \t");
+
+	for (size_t i = 0; i < updater->n_pending; i++) {
+		struct ExecEvent * pending = &updater->pending[i];
+		if (pending->id != id || !pending->sent) continue;
+		if (strcmp(status, "ok") == 0) {
+			updater->stats.succeeded++;
+			observeLatency(&updater->stats, pending->event.received);
+			updater->restarts = 0;
+			if (updater->options.verbose) printf("Helper handled event %llu\n", id);
+		} else {
+			updater->stats.failed++;
+			printf("Helper failed event %llu: %s\n", id, status);
+		}
+		updater->n_pending--;
+		memmove(pending, pending + 1, (updater->n_pending - i) * sizeof(*pending));
+		return;
+	}
+	if (updater->options.verbose) printf("Unexpected line from helper: %s\n", line);
+}
+
+static int readAcks(struct ExecUpdater * updater) {
+	char buf[EXEC_MAX_LINE];
+	for (;;) {
+		ssize_t len = read(updater->out_fd, buf, sizeof(buf));
+		if (len == -1 && errno == EAGAIN) return 0;
+		if (len == -1) return -1;
+		if (len == 0) return helperDied(updater);
+
+		for (ssize_t i = 0; i < len; i++) {
+			if (buf[i] != '\n') {
+				if (updater->line_len < sizeof(updater->line) - 1) updater->line[updater->line_len++] = buf[i];
+				else updater->line_skip = true;
+				continue;
+			}
+			updater->line[updater->line_len] = '\0';
+			if (!updater->line_skip) processAck(updater, updater->line);
+			updater->line_len = 0;
+			updater->line_skip = false;
+		}
+	}
+}
+
+int handleExecMessage(struct ExecUpdater * updater, int fd, int32_t events) {
+	// Left over from a helper already gone
+	if (fd < 0) return 0;
+	if (fd == updater->timer_fd) {
+		uint64_t expirations;
+		if (read(fd, &expirations, sizeof(expirations)) == -1) return errno == EAGAIN ? 0 : -1;
+		if (updater->pid != -1) return 0;
+		if (startHelper(updater) == 0) return 0;
+		perror("Couldn't start helper");
+		return helperDied(updater);
+	} else if (fd == updater->out_fd) {
+		return readAcks(updater);
+	} else if (fd == updater->in_fd) {
+		if (events & EPOLLERR) return helperDied(updater);
+		return sendPending(updater);
+	}
+	return 0;
+}
+
+bool execUpdaterIdle(struct ExecUpdater const * updater) {
+	return updater->n_pending == 0;
+}
+
+int execUpdate(struct ExecUpdater * updater, struct AddrEvent const * event) {
+	updater->stats.issued++;
+	// The helper hasn't seen an older change of this address yet, replace it
+	for (size_t i = 0; i < updater->n_pending; i++) {
+		struct ExecEvent * pending = &updater->pending[i];
+		if (pending->sent || pending->event.iface != event->iface) continue;
+		if (!event->combined && pending->event.addr.af != event->addr.af) continue;
+		pending->event = *event;
+		return 0;
+	}
+
+	if (updater->n_pending == EXEC_MAX_PENDING) {
+		printf("Helper is too far behind, dropping event %llu\n", updater->pending[0].id);
+		updater->stats.failed++;
+		updater->n_pending--;
+		memmove(updater->pending, updater->pending + 1, updater->n_pending * sizeof(*updater->pending));
+	}
+	updater->pending[updater->n_pending++] = (struct ExecEvent) {
+		.id = updater->next_id++,
+		.event = *event,
+		.sent = false,
+	};
+	return sendPending(updater);
+}
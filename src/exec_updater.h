@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/types.h>
+
+#include "ipaddr.h"
+#include "stats.h"
+
+// Events sent but not yet acknowledged, the oldest is dropped beyond this
+#define EXEC_MAX_PENDING 32
+// Longest acknowledgement line, longer ones are ignored
+#define EXEC_MAX_LINE 512
+// How long a helper gets to exit once signalled, before it is killed
+#define EXEC_STOP_MS 2000
+#define EXEC_STOP_POLL_MS 10
+
+struct ExecUpdaterOptions {
+	bool verbose;
+	// Run with /bin/sh -c
+	char const * command;
+	// The helper is restarted after retry_base_ms, doubling up to retry_max_ms
+	// while it keeps dying before acknowledging anything
+	unsigned int retry_base_ms;
+	unsigned int retry_max_ms;
+};
+
+struct ExecEvent {
+	unsigned long long id;
+	struct AddrEvent event;
+	// Written to the current helper, cleared when it is restarted
+	bool sent;
+};
+
+struct ExecUpdater {
+	struct ExecUpdaterOptions options;
+	struct UpdaterStats stats;
+	int epoll_fd;
+
+	// -1 while the helper is down
+	pid_t pid;
+	// Our ends of the helper's stdin and stdout
+	int in_fd;
+	int out_fd;
+	// Only polled for EPOLLOUT while the helper's stdin is full
+	bool in_blocked;
+	int timer_fd;
+	struct EpollData * in_data;
+	struct EpollData * out_data;
+	struct EpollData * timer_data;
+	// Restarts since the helper last acknowledged an event
+	unsigned int restarts;
+
+	unsigned long long next_id;
+	// Oldest first
+	struct ExecEvent pending[EXEC_MAX_PENDING];
+	size_t n_pending;
+
+	char line[EXEC_MAX_LINE];
+	size_t line_len;
+	// Discarding the rest of an overlong line
+	bool line_skip;
+};
+
+void destroyExecUpdater(struct ExecUpdater * updater);
+int execUpdate(struct ExecUpdater * updater, struct AddrEvent const * event);
+int handleExecMessage(struct ExecUpdater * updater, int fd, int32_t events);
+bool execUpdaterIdle(struct ExecUpdater const * updater);
+
+#include "updater.h"
+
+Updater_t createExecUpdater(int epoll_fd, struct ExecUpdaterOptions options);
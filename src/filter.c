@@ -1,22 +1,76 @@
 #include "filter.h"
 #include "ipaddr.h"
+#include "probes.h"
 
 #include <stdint.h>
 #include <stddef.h>
 #include <sys/socket.h>
 #include <linux/if_addr.h>
 #include <linux/rtnetlink.h>
+#include <linux/filter.h>
+#include <arpa/inet.h>
+#include <errno.h>
 
-struct rtattr* filterMessage(struct AddrFilter const * filter, struct nlmsghdr const * nlh){
+// ifindexes are allocated sequentially, so the low bits alone spread well.
+// Every namespace starts from 1, so offset them from each other.
+static size_t ifaceBucket(unsigned int netns, unsigned int iface) {
+	return (iface + netns * 7) & (FILTER_TABLE_SIZE - 1);
+}
+
+static size_t nextBucket(size_t bucket) {
+	return (bucket + 1) & (FILTER_TABLE_SIZE - 1);
+}
+
+int filterAddIface(struct AddrFilter * filter, unsigned int netns, unsigned int iface) {
+	int slot = filterIfaceSlot(filter, netns, iface);
+	if (slot >= 0) return slot;
+	if (filter->n_ifaces >= FILTER_MAX_IFACES || netns >= FILTER_MAX_NETNS) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	size_t bucket = ifaceBucket(netns, iface);
+	// Table is larger than ifaces, so there is always an empty bucket
+	while (filter->iface_table[bucket] != 0) bucket = nextBucket(bucket);
+
+	slot = filter->n_ifaces++;
+	filter->ifaces[slot] = iface;
+	filter->iface_netns[slot] = netns;
+	filter->iface_table[bucket] = slot + 1;
+	return slot;
+}
+
+int filterIfaceSlot(struct AddrFilter const * filter, unsigned int netns, unsigned int iface) {
+	for (size_t bucket = ifaceBucket(netns, iface);
+	     filter->iface_table[bucket] != 0;
+	     bucket = nextBucket(bucket)) {
+		int slot = filter->iface_table[bucket] - 1;
+		if (filter->ifaces[slot] == iface && filter->iface_netns[slot] == netns) return slot;
+	}
+	return -1;
+}
+
+bool filterHasNetns(struct AddrFilter const * filter, unsigned int netns) {
+	for (size_t slot = 0; slot < filter->n_ifaces; slot++) {
+		if (filter->iface_netns[slot] == netns) return true;
+	}
+	return false;
+}
+
+bool filterMessage(struct AddrFilter const * filter, unsigned int netns, struct nlmsghdr const * nlh,
+                   struct FilterResult * result){
 	struct ifaddrmsg * ifa = (struct ifaddrmsg *) NLMSG_DATA(nlh);
+	struct rtattr* addr_attr = NULL;
 
+	if (nlh->nlmsg_type != RTM_NEWADDR && nlh->nlmsg_type != RTM_DELADDR) goto reject;
 	if ((ifa->ifa_family == AF_INET6 && !filter->ipv6)
-	    || (ifa->ifa_family == AF_INET && !filter->ipv4)) return NULL;
-	if (ifa->ifa_index != filter->iface) return NULL;
-	if (ifa->ifa_scope != RT_SCOPE_UNIVERSE && ifa->ifa_scope != RT_SCOPE_SITE) return NULL;
+	    || (ifa->ifa_family == AF_INET && !filter->ipv4)) goto reject;
+	int iface_slot = filterIfaceSlot(filter, netns, ifa->ifa_index);
+	if (iface_slot < 0) goto reject;
+	if (ifa->ifa_scope != RT_SCOPE_UNIVERSE && ifa->ifa_scope != RT_SCOPE_SITE) goto reject;
 
 	uint32_t flags = ifa->ifa_flags;
-	struct rtattr* addr_attr = NULL;
+	struct ifa_cacheinfo const * cacheinfo = NULL;
 
 	struct rtattr* rth;
 	size_t rtmsg_len;
@@ -30,11 +84,104 @@ struct rtattr* filterMessage(struct AddrFilter const * filter, struct nlmsghdr c
 		case IFA_FLAGS:
 			flags = *(uint32_t *) RTA_DATA(rth);
 			break;
+		case IFA_CACHEINFO:
+			if (RTA_PAYLOAD(rth) >= sizeof(*cacheinfo)) cacheinfo = RTA_DATA(rth);
+			break;
 		}
 	}
-	if ((flags & IFA_F_DEPRECATED) || ((flags & IFA_F_TEMPORARY) && !filter->allow_temporary)) return NULL;
+	if (addr_attr == NULL || ((flags & IFA_F_TEMPORARY) && !filter->allow_temporary)) goto reject;
 	struct IPAddr addr = addrFromAttr(ifa, addr_attr);
-	if (addrIsPrivate(addr) && !filter->allow_private) return NULL;
+	if (addrIsPrivate(addr) && !filter->allow_private) goto reject;
+
+	result->slot = iface_slot;
+	result->addr_attr = addr_attr;
+	result->flags = flags;
+	result->cacheinfo = cacheinfo;
+	PROBE(filter__accept, ifa->ifa_index, ifa->ifa_family, RTA_DATA(addr_attr));
+	return true;
+
+reject:
+	PROBE(filter__reject, ifa->ifa_index, ifa->ifa_family, addr_attr == NULL ? NULL : RTA_DATA(addr_attr));
+	return false;
+}
+
+// Jump targets for filterAttach, anything else is a relative offset
+enum BPFLabel {
+	BPF_LABEL_NEXT = 0,
+	BPF_LABEL_ACCEPT = -1,
+	BPF_LABEL_REJECT = -2,
+};
+
+struct BPFProgram {
+	struct sock_filter insns[16 + FILTER_MAX_IFACES];
+	int jt[16 + FILTER_MAX_IFACES];
+	int jf[16 + FILTER_MAX_IFACES];
+	size_t len;
+};
+
+static void emit(struct BPFProgram * prog, uint16_t code, uint32_t k, int jt, int jf) {
+	prog->insns[prog->len] = (struct sock_filter) BPF_STMT(code, k);
+	prog->jt[prog->len] = jt;
+	prog->jf[prog->len] = jf;
+	prog->len++;
+}
+
+// Loads are relative to the start of the nlmsghdr. BPF loads words in network
+// byte order, netlink is in host byte order, so constants are swapped to match.
+#define NLMSG_OFF(field) offsetof(struct nlmsghdr, field)
+#define IFA_OFF(field) (NLMSG_HDRLEN + offsetof(struct ifaddrmsg, field))
+
+int filterAttach(struct AddrFilter const * filter, unsigned int netns, int sock) {
+	struct BPFProgram prog = {.len = 0};
+
+	// Pass anything that isn't an address (errors, end of dump...)
+	emit(&prog, BPF_LD | BPF_H | BPF_ABS, NLMSG_OFF(nlmsg_type), 0, 0);
+	emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_NEWADDR), 1, BPF_LABEL_NEXT);
+	emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, htons(RTM_DELADDR), BPF_LABEL_NEXT, BPF_LABEL_ACCEPT);
+	// Dump replies pack several messages into one datagram, only the first is visible
+	emit(&prog, BPF_LD | BPF_H | BPF_ABS, NLMSG_OFF(nlmsg_flags), 0, 0);
+	emit(&prog, BPF_JMP | BPF_JSET | BPF_K, htons(NLM_F_MULTI), BPF_LABEL_ACCEPT, BPF_LABEL_NEXT);
+
+	emit(&prog, BPF_LD | BPF_B | BPF_ABS, IFA_OFF(ifa_family), 0, 0);
+	if (!filter->ipv4) emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, AF_INET, BPF_LABEL_REJECT, BPF_LABEL_NEXT);
+	if (!filter->ipv6) emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, AF_INET6, BPF_LABEL_REJECT, BPF_LABEL_NEXT);
+
+	emit(&prog, BPF_LD | BPF_B | BPF_ABS, IFA_OFF(ifa_scope), 0, 0);
+	emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, RT_SCOPE_UNIVERSE, 1, BPF_LABEL_NEXT);
+	emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, RT_SCOPE_SITE, BPF_LABEL_NEXT, BPF_LABEL_REJECT);
+
+	// IFA_FLAGS may hold more, but the low byte is duplicated in ifa_flags.
+	// Deprecated addresses pass, their change of state matters for selection.
+	if (!filter->allow_temporary) {
+		emit(&prog, BPF_LD | BPF_B | BPF_ABS, IFA_OFF(ifa_flags), 0, 0);
+		emit(&prog, BPF_JMP | BPF_JSET | BPF_K, IFA_F_TEMPORARY, BPF_LABEL_REJECT, BPF_LABEL_NEXT);
+	}
+
+	emit(&prog, BPF_LD | BPF_W | BPF_ABS, IFA_OFF(ifa_index), 0, 0);
+	for (size_t i = 0; i < filter->n_ifaces; i++) {
+		if (filter->iface_netns[i] != netns) continue;
+		emit(&prog, BPF_JMP | BPF_JEQ | BPF_K, htonl(filter->ifaces[i]), BPF_LABEL_ACCEPT, BPF_LABEL_NEXT);
+	}
+
+	emit(&prog, BPF_RET | BPF_K, 0, 0, 0);
+	emit(&prog, BPF_RET | BPF_K, UINT32_MAX, 0, 0);
+	size_t const reject = prog.len - 2;
+	size_t const accept = prog.len - 1;
+
+	for (size_t i = 0; i < prog.len; i++) {
+		int * jumps[] = {&prog.jt[i], &prog.jf[i]};
+		unsigned char * offsets[] = {&prog.insns[i].jt, &prog.insns[i].jf};
+		for (size_t j = 0; j < 2; j++) {
+			size_t target = *jumps[j] == BPF_LABEL_ACCEPT ? accept
+				: *jumps[j] == BPF_LABEL_REJECT ? reject
+				: i + 1 + *jumps[j];
+			*offsets[j] = target - (i + 1);
+		}
+	}
 
-	return addr_attr;
+	struct sock_fprog fprog = {
+		.len = prog.len,
+		.filter = prog.insns,
+	};
+	return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
 }
@@ -2,9 +2,23 @@
 
 #include <linux/netlink.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILTER_MAX_IFACES 64
+// Namespace 0 is our own, others are numbered by the caller
+#define FILTER_MAX_NETNS 16
+// Must be a power of two, larger than FILTER_MAX_IFACES
+#define FILTER_TABLE_SIZE (2 * FILTER_MAX_IFACES)
 
 struct AddrFilter {
-	unsigned int iface;
+	// Monitored interfaces, a message's slot is its index in these arrays.
+	// ifindexes are only unique within a network namespace.
+	unsigned int ifaces[FILTER_MAX_IFACES];
+	unsigned char iface_netns[FILTER_MAX_IFACES];
+	size_t n_ifaces;
+	// Open-addressed (netns, ifindex) -> slot + 1 lookup, 0 marks an empty bucket
+	unsigned char iface_table[FILTER_TABLE_SIZE];
 
 	bool allow_private;
 	bool allow_temporary;
@@ -13,4 +27,26 @@ struct AddrFilter {
 	bool ipv6;
 };
 
-struct rtattr* filterMessage(struct AddrFilter const * filter, struct nlmsghdr const * nlh);
+// Returns the slot of iface (existing or new), or -1 if the filter is full
+int filterAddIface(struct AddrFilter * filter, unsigned int netns, unsigned int iface);
+// Returns -1 if iface is not monitored
+int filterIfaceSlot(struct AddrFilter const * filter, unsigned int netns, unsigned int iface);
+// Whether any interface in netns is monitored
+bool filterHasNetns(struct AddrFilter const * filter, unsigned int netns);
+// Attach a classic BPF program to a NETLINK_ROUTE socket in netns, dropping address
+// notifications the filter would reject (bar private ranges) in the kernel
+int filterAttach(struct AddrFilter const * filter, unsigned int netns, int sock);
+// What filterMessage extracts from an accepted message
+struct FilterResult {
+	// Slot of the message's interface
+	size_t slot;
+	struct rtattr * addr_attr;
+	uint32_t flags;
+	// NULL if the message carries none
+	struct ifa_cacheinfo const * cacheinfo;
+};
+
+// Accepts RTM_NEWADDR and RTM_DELADDR for monitored addresses, including
+// deprecated ones, as they still take part in address selection
+bool filterMessage(struct AddrFilter const * filter, unsigned int netns, struct nlmsghdr const * nlh,
+                   struct FilterResult * result);
@@ -39,7 +39,7 @@ static bool addrInRange(const struct IPAddr test_addr, const struct IPAddr ref_a
 }
 
 struct IPAddr addrFromAttr(struct ifaddrmsg const * msg, struct rtattr const * attr) {
-	struct IPAddr addr = { .af = msg->ifa_family };
+	struct IPAddr addr = { .af = msg->ifa_family, .prefixlen = msg->ifa_prefixlen };
 	switch (addr.af) {
 	case AF_INET:
 		addr.ipv4 = *((struct in_addr *) RTA_DATA(attr));
@@ -85,6 +85,76 @@ int printAddr(struct IPAddr const address){
 	}
 }
 
+static char * formatByte(unsigned char byte, char * pos) {
+	if (byte >= 100) *pos++ = '0' + byte / 100;
+	if (byte >= 10) *pos++ = '0' + byte / 10 % 10;
+	*pos++ = '0' + byte % 10;
+	return pos;
+}
+
+static char * formatIPv4(unsigned char const * bytes, char * pos) {
+	for (size_t i = 0; i < 4; i++) {
+		if (i > 0) *pos++ = '.';
+		pos = formatByte(bytes[i], pos);
+	}
+	return pos;
+}
+
+// inet_ntop goes through sprintf for every group, which dominates URL rendering
+size_t formatAddr(struct IPAddr const * addr, char * dst) {
+	static char const hex[] = "0123456789abcdef";
+	char * pos = dst;
+
+	switch (addr->af) {
+	case AF_INET:
+		pos = formatIPv4((unsigned char const *) &addr->ipv4.s_addr, pos);
+		break;
+	case AF_INET6: {
+		uint16_t words[8];
+		for (size_t i = 0; i < 8; i++) {
+			words[i] = addr->ipv6.s6_addr[2 * i] << 8 | addr->ipv6.s6_addr[2 * i + 1];
+		}
+
+		// Longest run of at least two zero groups is elided, the first if tied (RFC 5952)
+		int best_base = -1, best_len = 0;
+		for (int i = 0; i < 8;) {
+			int len = 0;
+			while (i + len < 8 && words[i + len] == 0) len++;
+			if (len > best_len && len >= 2) {
+				best_base = i;
+				best_len = len;
+			}
+			i += len > 0 ? len : 1;
+		}
+
+		for (int i = 0; i < 8; i++) {
+			if (i == best_base) {
+				*pos++ = ':';
+				i += best_len - 1;
+				if (i == 7) *pos++ = ':';
+				continue;
+			}
+			if (i > 0) *pos++ = ':';
+			// IPv4-compatible and -mapped addresses end in dotted quad, as with inet_ntop
+			if (i == 6 && best_base == 0 && (best_len == 6 || (best_len == 5 && words[5] == 0xffff))) {
+				pos = formatIPv4(&addr->ipv6.s6_addr[12], pos);
+				break;
+			}
+			bool leading = true;
+			for (int shift = 12; shift >= 0; shift -= 4) {
+				unsigned char nibble = (words[i] >> shift) & 0xF;
+				if (leading && nibble == 0 && shift > 0) continue;
+				leading = false;
+				*pos++ = hex[nibble];
+			}
+		}
+		break;
+	}}
+
+	*pos = '\0';
+	return pos - dst;
+}
+
 // Might use a different return code for invalid result, save checking/setting errno
 bool addrIsPrivate(const struct IPAddr addr){
 	struct IPAddr ref_addr = {.af=addr.af};	// Ensure address is initialized before use
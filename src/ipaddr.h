@@ -3,6 +3,8 @@
 #include <linux/rtnetlink.h>
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 struct IPAddr {
 	union {
@@ -10,6 +12,29 @@ struct IPAddr {
 		struct in_addr ipv4;
 	}; // First so doesn't need to be named
 	unsigned char af;
+	// Not considered by addrEqual
+	unsigned char prefixlen;
+};
+
+// What an updater is told about a change
+struct AddrEvent {
+	char const * iface;
+	unsigned int ifindex;
+	// iface's namespace, as numbered in the monitor's filter, and its name, NULL for our own
+	unsigned char netns;
+	char const * netns_name;
+	struct IPAddr addr;
+	// IFA_F_* of addr
+	uint32_t flags;
+	// Address of addr's family published before, AF_UNSPEC if none
+	struct IPAddr previous;
+	// Latest published address of each family on iface, AF_UNSPEC if none
+	struct IPAddr ipv4;
+	struct IPAddr ipv6;
+	// Publishes ipv4 and ipv6 together, rather than just addr
+	bool combined;
+	// CLOCK_MONOTONIC time the change arrived from netlink, for latency metrics
+	struct timespec received;
 };
 
 // Assumes valid msg->ifa_family
@@ -19,3 +44,6 @@ bool addrIsLoopback(struct IPAddr const addr);
 // AF_UNSPEC always compare unequal
 bool addrEqual(struct IPAddr const addr1, struct IPAddr const addr2);
 int printAddr(struct IPAddr const addr);
+// Same text as inet_ntop, dst must hold INET6_ADDRSTRLEN bytes. Returns the
+// length written excluding the NULL, 0 for AF_UNSPEC.
+size_t formatAddr(struct IPAddr const * addr, char * dst);
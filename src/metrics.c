@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+#include "metrics.h"
+#include "stats.h"
+#include "strlcpy.h"
+#include "util.h"
+
+#define METRICS_HOST "127.0.0.1"
+
+static unsigned int const bucket_bounds_ms[N_LATENCY_BUCKETS] = {LATENCY_BUCKETS_MS};
+
+struct MetricsClient {
+	int fd;
+	struct EpollData epoll_data;
+	// Order of acceptance, the oldest makes way when all are taken
+	unsigned long long accepted;
+};
+
+struct MetricsServer {
+	int epoll_fd;
+	int listen_fd;
+	struct EpollData listen_data;
+	// Removed on destroy, if we created it
+	char unix_path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+	struct MetricsClient clients[METRICS_MAX_CLIENTS];
+	unsigned long long n_accepted;
+
+	Monitor_t monitor;
+	Updater_t updater;
+	char response[METRICS_MAX_RESPONSE];
+};
+
+static int parseListen(char const * listen, struct sockaddr_storage * addr, socklen_t * addr_len) {
+	char host[NI_MAXHOST];
+	char const * port;
+	if (strncmp(listen, "unix:", 5) == 0 || listen[0] == '/') {
+		struct sockaddr_un * un = (struct sockaddr_un *) addr;
+		char const * path = listen[0] == '/' ? listen : listen + 5;
+		un->sun_family = AF_UNIX;
+		if (strlcpy(un->sun_path, path, sizeof(un->sun_path)) >= sizeof(un->sun_path)) goto invalid;
+		*addr_len = sizeof(*un);
+		return 0;
+	} else if (listen[0] == '[') {
+		char const * end = strchr(listen, ']');
+		if (end == NULL || end[1] != ':' || (size_t) (end - listen) > sizeof(host)) goto invalid;
+		strlcpy(host, listen + 1, end - listen);
+		port = end + 2;
+	} else if (strchr(listen, ':') != NULL) {
+		char const * colon = strrchr(listen, ':');
+		if ((size_t) (colon - listen) >= sizeof(host)) goto invalid;
+		strlcpy(host, listen, colon - listen + 1);
+		port = colon + 1;
+	} else {
+		// Nothing else should be able to see our addresses by default
+		strlcpy(host, METRICS_HOST, sizeof(host));
+		port = listen;
+	}
+
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE,
+	};
+	struct addrinfo * result;
+	if (getaddrinfo(host, port, &hints, &result) != 0) goto invalid;
+	memcpy(addr, result->ai_addr, result->ai_addrlen);
+	*addr_len = result->ai_addrlen;
+	freeaddrinfo(result);
+	return 0;
+
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+static int addEpoll(MetricsServer_t server, int fd, struct EpollData * data) {
+	data->tag = EPOLL_METRICS;
+	data->fd = fd;
+	data->metrics = server;
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data = { .ptr = data },
+	};
+	return epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+MetricsServer_t createMetricsServer(char const * listen_spec, int epoll_fd, Monitor_t monitor, Updater_t updater) {
+	MetricsServer_t server = malloc(sizeof(*server));
+	if (server == NULL) return NULL;
+	server->epoll_fd = epoll_fd;
+	server->listen_fd = -1;
+	server->unix_path[0] = '\0';
+	server->monitor = monitor;
+	server->updater = updater;
+	server->n_accepted = 0;
+	for (size_t i = 0; i < METRICS_MAX_CLIENTS; i++) server->clients[i].fd = -1;
+
+	struct sockaddr_storage addr = {0};
+	socklen_t addr_len;
+	if (parseListen(listen_spec, &addr, &addr_len) != 0) goto cleanup;
+
+	server->listen_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->listen_fd == -1) goto cleanup;
+	if (addr.ss_family == AF_UNIX) {
+		// Left behind by an earlier run
+		char const * path = ((struct sockaddr_un *) &addr)->sun_path;
+		if (unlink(path) == -1 && errno != ENOENT) goto cleanup;
+	} else {
+		int const reuse = 1;
+		if (setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) goto cleanup;
+	}
+	if (bind(server->listen_fd, (struct sockaddr *) &addr, addr_len) == -1) goto cleanup;
+	if (addr.ss_family == AF_UNIX) {
+		strlcpy(server->unix_path, ((struct sockaddr_un *) &addr)->sun_path, sizeof(server->unix_path));
+	}
+	if (listen(server->listen_fd, METRICS_MAX_CLIENTS) == -1) goto cleanup;
+	if (addEpoll(server, server->listen_fd, &server->listen_data) == -1) goto cleanup;
+
+	return server;
+
+cleanup:
+	destroyMetricsServer(server);
+	return NULL;
+}
+
+static void closeClient(MetricsServer_t server, struct MetricsClient * client) {
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	client->fd = -1;
+}
+
+void destroyMetricsServer(MetricsServer_t server) {
+	for (size_t i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (server->clients[i].fd >= 0) closeClient(server, &server->clients[i]);
+	}
+	if (server->listen_fd >= 0) {
+		epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, server->listen_fd, NULL);
+		close(server->listen_fd);
+	}
+	if (server->unix_path[0] != '\0') unlink(server->unix_path);
+	free(server);
+}
+
+// Appends to the response, silently truncating once full
+static void append(char * buf, size_t * len, char const * format, ...) __attribute__((format(printf, 3, 4)));
+static void append(char * buf, size_t * len, char const * format, ...) {
+	if (*len >= METRICS_MAX_RESPONSE) return;
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buf + *len, METRICS_MAX_RESPONSE - *len, format, args);
+	va_end(args);
+	if (n > 0) *len += n;
+}
+
+static void counter(char * buf, size_t * len, char const * name, char const * help, unsigned long long value) {
+	append(buf, len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
+
+static size_t render(MetricsServer_t server) {
+	struct MonitorStats const monitor = monitorStats(server->monitor);
+	struct UpdaterStats const * updater = updaterStats(server->updater);
+	char * buf = server->response;
+	size_t len = 0;
+
+	// Content-Length is unknown until the body is rendered, and HTTP/1.0 doesn't need it
+	append(buf, &len, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+	counter(buf, &len, "dyndns_netlink_messages_total", "Address messages received from netlink.",
+	        monitor.delivered);
+	counter(buf, &len, "dyndns_netlink_rejected_total", "Address messages dropped by the userspace filter.",
+	        monitor.rejected);
+	counter(buf, &len, "dyndns_netlink_deduped_total", "Address changes that left the published address as it was.",
+	        monitor.deduped);
+	counter(buf, &len, "dyndns_netlink_buffer_regrowths_total", "Datagrams that didn't fit the receive buffer.",
+	        monitor.regrowths);
+	counter(buf, &len, "dyndns_netlink_overruns_total", "Times the netlink socket dropped messages.",
+	        monitor.overruns);
+	counter(buf, &len, "dyndns_updates_issued_total", "Updates started, excluding retries.", updater->issued);
+	counter(buf, &len, "dyndns_updates_succeeded_total", "Updates that succeeded.", updater->succeeded);
+	counter(buf, &len, "dyndns_updates_failed_total", "Updates given up on.", updater->failed);
+	counter(buf, &len, "dyndns_updates_retried_total", "Retries of failed updates.", updater->retried);
+	counter(buf, &len, "dyndns_updates_throttled_total", "Updates held back by the rate limit.", updater->throttled);
+
+	char const * const name = "dyndns_update_latency_seconds";
+	append(buf, &len, "# HELP %s Time from receiving an address change to a successful update.\n"
+	       "# TYPE %s histogram\n", name, name);
+	unsigned long long cumulative = 0;
+	for (size_t i = 0; i < N_LATENCY_BUCKETS; i++) {
+		cumulative += updater->latency_buckets[i];
+		append(buf, &len, "%s_bucket{le=\"%g\"} %llu\n", name, bucket_bounds_ms[i] / 1000.0, cumulative);
+	}
+	append(buf, &len, "%s_bucket{le=\"+Inf\"} %llu\n", name, updater->latency_count);
+	append(buf, &len, "%s_sum %.6f\n%s_count %llu\n", name, updater->latency_sum, name, updater->latency_count);
+	return len < METRICS_MAX_RESPONSE ? len : METRICS_MAX_RESPONSE - 1;
+}
+
+static int acceptClient(MetricsServer_t server) {
+	int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1) {
+		// Gone again before we got to it, or out of fds, which shouldn't end monitoring
+		return errno == EAGAIN || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE ? 0 : -1;
+	}
+	// Clients are answered as soon as they send anything, so when all are taken, the oldest has been
+	// idle longest. It is dropped rather than the newcomer, so idle connections can't lock scrapers out.
+	struct MetricsClient * client = &server->clients[0];
+	for (size_t i = 0; i < METRICS_MAX_CLIENTS && client->fd >= 0; i++) {
+		struct MetricsClient * candidate = &server->clients[i];
+		if (candidate->fd < 0 || candidate->accepted < client->accepted) client = candidate;
+	}
+	if (client->fd >= 0) closeClient(server, client);
+	client->fd = fd;
+	client->accepted = server->n_accepted++;
+	if (addEpoll(server, fd, &client->epoll_data) == -1) {
+		client->fd = -1;
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+int processMetrics(MetricsServer_t server, int fd, int32_t events) {
+	if (fd == server->listen_fd) return acceptClient(server);
+
+	struct MetricsClient * client = NULL;
+	for (size_t i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		if (server->clients[i].fd == fd) client = &server->clients[i];
+	}
+	if (client == NULL) return 0;
+
+	// Whatever was asked for, there's only one page. The request is read so
+	// closing doesn't reset the connection before the response gets there.
+	char request[512];
+	if (events & EPOLLIN && recv(fd, request, sizeof(request), 0) == -1 && errno == EAGAIN) return 0;
+	size_t len = render(server);
+	// Fits the socket buffer of a fresh connection, so a single send will do
+	send(fd, server->response, len, MSG_NOSIGNAL);
+	shutdown(fd, SHUT_WR);
+	closeClient(server, client);
+	return 0;
+}
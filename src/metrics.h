@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "monitor.h"
+#include "updater.h"
+
+// Connections served at once, each new one beyond that takes the place of the oldest
+#define METRICS_MAX_CLIENTS 4
+// Whole response, headers included
+#define METRICS_MAX_RESPONSE 4096
+
+typedef struct MetricsServer * MetricsServer_t;
+// Serves Prometheus text format over HTTP from the event loop. listen is
+// unix:PATH or an absolute path for a unix socket, PORT for 127.0.0.1:PORT,
+// or ADDR:PORT, [ADDR]:PORT for IPv6.
+MetricsServer_t createMetricsServer(char const * listen, int epoll_fd, Monitor_t monitor, Updater_t updater);
+int processMetrics(MetricsServer_t server, int fd, int32_t events);
+void destroyMetricsServer(MetricsServer_t server);
@@ -1,34 +1,149 @@
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/if_addr.h>
+#include <linux/sock_diag.h>
 #include <sys/socket.h>
+#include <net/if.h>
 #ifndef SOL_NETLINK
 #define SOL_NETLINK 270
 #endif /*SOL_NETLINK*/
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif /*NETLINK_GET_STRICT_CHK*/
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <errno.h>
 
 #include "monitor.h"
 #include "ipaddr.h"
 #include "util.h"
+#include "timespec.h"
+#include "record.h"
+#include "netns.h"
+#include "candidates.h"
+#include "probes.h"
+#include "uring.h"
+
+// Datagrams read per wakeup before yielding back to the event loop
+#define MONITOR_MAX_BATCH 64
+// Changes the updater had no room for are offered again after this long
+#define MONITOR_RETRY_MS 10
+// Dump requests are numbered slot + 1, notifications have sequence number 0
+#define DUMP_SEQ_ALL (FILTER_MAX_IFACES + 1)
+// IFA_CACHEINFO lifetime of addresses that don't expire
+#define LIFETIME_FOREVER 0xFFFFFFFFU
+// Enough for a receive per socket and the settle timeout, the kernel doubles it for completions
+#define URING_ENTRIES 32
+// One datagram per buffer. Dumps are sized to fit the reader's buffer, notifications are far smaller.
+#define URING_BUFFERS 32
+#define URING_BUFFER_LEN 8192
+#define URING_BUFFER_GROUP 0
+// Operation in the top half of user_data, socket index and generation or settle generation in the bottom
+#define URING_RECEIVE (1ULL << 32)
+#define URING_SETTLE (2ULL << 32)
+#define URING_IGNORE (3ULL << 32)
+#define URING_OP_MASK (~0ULL << 32)
+#define URING_INDEX_BITS 8
+#define URING_GENERATION_MASK 0xFFFFFFU
+
+enum AddrFamilySlot {
+	FAMILY_IPV4,
+	FAMILY_IPV6,
+	N_FAMILIES,
+};
+
+// One netlink socket per network namespace with monitored interfaces, fd -1 if the
+// slot is free
+struct MonitorSocket {
+	int fd;
+	unsigned int netns;
+	struct EpollData epoll_data;
+	// Tells its receive completions from those of a socket closed before it in the same slot
+	uint32_t generation;
+	// Datagrams the kernel dropped for lack of room so far
+	uint32_t drops;
+	// Kernel filters dumps by interface, so dump monitored ones one at a time
+	bool strict;
+	// Only one dump at a time per socket, the next is requested once it's done
+	bool dumping;
+	// Without strict dumps, a dump of every interface is due
+	bool dump_due;
+};
+
+// Events point at interface names, and may outlive a reconfiguration, so
+// names are kept until destroyMonitor
+struct IfaceName {
+	struct IfaceName * next;
+	unsigned int netns;
+	unsigned int ifindex;
+	char name[IF_NAMESIZE];
+};
 
 struct Monitor {
 	struct AddrFilter filter;
+	struct MonitorOptions options;
+	struct MonitorStats stats;
+	struct timespec start;
 	char * buf;
 	size_t buf_len;
-	int socket;
+	struct MonitorSocket sockets[FILTER_MAX_NETNS];
+	size_t n_sockets;
+	uint32_t socket_generation;
 
 	int epoll_fd;
-	struct EpollData epoll_data;
 
-	struct IPAddr prev_addr;
+	int timer_fd;
+	struct EpollData timer_data;
+	// Start of the current settle window, if settling
+	struct timespec settle_start;
+	bool settling;
+	// Changes are pending that the updater turned away
+	bool holding;
+
+	// With options.io_uring, sockets and settling are serviced through the ring instead
+	struct Uring uring;
+	struct UringBuffers uring_buffers;
+	struct EpollData uring_data;
+	// Read by the kernel on submission
+	struct msghdr uring_msghdr;
+	struct __kernel_timespec settle_deadline;
+	// Bumped whenever the settle timeout is replaced, so stale completions are ignored
+	uint32_t settle_generation;
+
+	// Indexed by filter slot
+	char const * iface_names[FILTER_MAX_IFACES];
+	struct IfaceName * names;
+	// With strict dumps, the interface is to be dumped
+	bool dump_due[FILTER_MAX_IFACES];
+	// Last address of each family handed to the updater. Kept per family, so
+	// alternating IPv4 and IPv6 messages aren't taken for changes.
+	struct IPAddr published[FILTER_MAX_IFACES][N_FAMILIES];
+	// Addresses to choose from, and whether they changed in the current batch
+	struct CandidateSet candidates[FILTER_MAX_IFACES][N_FAMILIES];
+	bool pending[FILTER_MAX_IFACES][N_FAMILIES];
+	// When the first change still pending arrived
+	struct timespec received[FILTER_MAX_IFACES][N_FAMILIES];
 	Updater_t updater;
 };
 
-static ssize_t createSocket(){
+static uint64_t monotonicSeconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static enum AddrFamilySlot familySlot(unsigned char af) {
+	return af == AF_INET ? FAMILY_IPV4 : FAMILY_IPV6;
+}
+
+static ssize_t createSocket(struct AddrFilter const * filter, unsigned int netns, bool kernel_filter){
 	ssize_t sock;
 	struct sockaddr_nl addr = {
 		.nl_family = AF_NETLINK,
@@ -43,6 +158,11 @@ static ssize_t createSocket(){
 		goto cleanup;
 	}
 
+	// Before bind, so no notification can slip through unfiltered
+	if (kernel_filter && filterAttach(filter, netns, sock) == -1) {
+		goto cleanup;
+	}
+
 	if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr))) == -1) {
 		goto cleanup;
 	}
@@ -53,7 +173,8 @@ cleanup:
 	return -1;
 }
 
-static int requestAddr(struct AddrFilter const * filter, ssize_t const sock){
+// iface 0 dumps every interface
+static int requestAddr(struct AddrFilter const * filter, int const sock, unsigned int iface, uint32_t seq){
 	unsigned char af =
 		(filter->ipv4 && !filter->ipv6) ? AF_INET
 		: (filter->ipv6 && !filter->ipv4) ? AF_INET6
@@ -65,13 +186,15 @@ static int requestAddr(struct AddrFilter const * filter, ssize_t const sock){
 	} req = {
 		.nlh = {
 			.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
-			.nlmsg_flags = NLM_F_REQUEST | NLM_F_ROOT | NLM_F_MATCH,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
 			.nlmsg_type = RTM_GETADDR,
+			.nlmsg_seq = seq,
 			.nlmsg_pid = getpid(),
 		}, .ifa = {
 			.ifa_family = af,
-			// Does nothing as NLM_F_MATCH not implemented
-			.ifa_index = filter->iface,
+			// Only honoured with NETLINK_GET_STRICT_CHK (Linux 4.20+),
+			// otherwise every interface is dumped and filtered in userspace
+			.ifa_index = iface,
 		},
 	};
 
@@ -82,42 +205,322 @@ static int requestAddr(struct AddrFilter const * filter, ssize_t const sock){
 	}
 }
 
-Monitor_t createMonitor(struct AddrFilter const filter, size_t buf_len, int epoll_fd, Updater_t updater) {
-	struct Monitor * monitor = malloc(sizeof(*monitor));
-	monitor->updater = updater;
-	monitor->epoll_fd = -1;
-	monitor->prev_addr.af = AF_UNSPEC;
+// Only the monitor's thread writes its stats, but metrics read them from the updater's when threaded, so
+// no store may tear
+static void count(unsigned long long * counter) {
+	__atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
 
-	monitor->socket = createSocket();
-	if (monitor->socket == -1) goto cleanup;
+static long long elapsedUs(struct timespec start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) * 1000000LL + (now.tv_nsec - start.tv_nsec) / 1000;
+}
 
-	monitor->filter = filter;
-	if (filter.ipv4) {
-		enum rtnetlink_groups group = RTNLGRP_IPV4_IFADDR;
-		if (setsockopt(monitor->socket, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) == -1) goto cleanup;
+// Request the next dump on monitor_socket, if any are left
+static int nextDump(Monitor_t monitor, struct MonitorSocket * monitor_socket) {
+	struct AddrFilter const * filter = &monitor->filter;
+	monitor_socket->dumping = false;
+	if (!monitor_socket->strict) {
+		if (!monitor_socket->dump_due) goto done;
+		monitor_socket->dump_due = false;
+		monitor_socket->dumping = true;
+		return requestAddr(filter, monitor_socket->fd, 0, DUMP_SEQ_ALL);
+	}
+
+	for (size_t slot = 0; slot < filter->n_ifaces; slot++) {
+		if (filter->iface_netns[slot] != monitor_socket->netns || !monitor->dump_due[slot]) continue;
+		monitor->dump_due[slot] = false;
+		monitor_socket->dumping = true;
+		return requestAddr(filter, monitor_socket->fd, filter->ifaces[slot], slot + 1);
+	}
+
+done:
+	for (size_t i = 0; i < monitor->n_sockets; i++) {
+		if (monitor->sockets[i].dumping) return 0;
 	}
+	if (monitor->stats.dump_us < 0) {
+		__atomic_store_n(&monitor->stats.dump_us, elapsedUs(monitor->start), __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+// Dump every interface in the socket's namespace, once any dump underway is done
+static int startDump(Monitor_t monitor, struct MonitorSocket * monitor_socket) {
+	monitor_socket->dump_due = true;
+	for (size_t slot = 0; slot < monitor->filter.n_ifaces; slot++) {
+		if (monitor->filter.iface_netns[slot] == monitor_socket->netns) monitor->dump_due[slot] = true;
+	}
+	return monitor_socket->dumping ? 0 : nextDump(monitor, monitor_socket);
+}
+
+static struct MonitorSocket * findSocket(Monitor_t monitor, unsigned int netns) {
+	for (size_t i = 0; i < monitor->n_sockets; i++) {
+		if (monitor->sockets[i].fd >= 0 && monitor->sockets[i].netns == netns) return &monitor->sockets[i];
+	}
+	return NULL;
+}
 
-	if (filter.ipv6) {
-		enum rtnetlink_groups group = RTNLGRP_IPV6_IFADDR;
-		if (setsockopt(monitor->socket, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) == -1) goto cleanup;
+static uint64_t receiveData(Monitor_t monitor, size_t index) {
+	return URING_RECEIVE | (uint64_t) monitor->sockets[index].generation << URING_INDEX_BITS | index;
+}
+
+static int armReceive(Monitor_t monitor, size_t index) {
+	struct io_uring_sqe * sqe = uringSqe(&monitor->uring);
+	if (sqe == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	// Keeps receiving into a buffer of the group per datagram until it runs out
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = monitor->sockets[index].fd;
+	sqe->addr = (uintptr_t) &monitor->uring_msghdr;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_TRUNC;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = monitor->uring_buffers.group;
+	sqe->user_data = receiveData(monitor, index);
+	return 0;
+}
+
+// Queue the end of the socket's multishot receive, which otherwise keeps the socket open in the kernel
+static int cancelReceive(Monitor_t monitor, size_t index) {
+	struct io_uring_sqe * sqe = uringSqe(&monitor->uring);
+	if (sqe == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = receiveData(monitor, index);
+	sqe->user_data = URING_IGNORE;
+	return 0;
+}
+
+// Takes a free slot for sock. With io_uring, its receive is only queued, for the caller to submit.
+static struct MonitorSocket * watchSocket(Monitor_t monitor, int sock, unsigned int netns, bool strict) {
+	size_t index = 0;
+	while (index < monitor->n_sockets && monitor->sockets[index].fd >= 0) index++;
+	if (index == NELEMS(monitor->sockets)) {
+		errno = EMFILE;
+		return NULL;
+	}
+	struct MonitorSocket * monitor_socket = &monitor->sockets[index];
+	monitor_socket->fd = sock;
+	monitor_socket->netns = netns;
+	monitor_socket->strict = strict;
+	monitor_socket->dumping = false;
+	monitor_socket->dump_due = false;
+	monitor_socket->generation = ++monitor->socket_generation & URING_GENERATION_MASK;
+	monitor_socket->drops = 0;
+	if (monitor->options.io_uring) {
+		if (armReceive(monitor, index) != 0) {
+			monitor_socket->fd = -1;
+			return NULL;
+		}
+	} else {
+		struct EpollData * data = &monitor_socket->epoll_data;
+		data->tag = EPOLL_MONITOR;
+		data->fd = sock;
+		data->monitor = monitor;
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data = { .ptr = data },
+		};
+		if (epoll_ctl(monitor->epoll_fd, EPOLL_CTL_ADD, sock, &event) == -1) {
+			monitor_socket->fd = -1;
+			return NULL;
+		}
+	}
+	if (index == monitor->n_sockets) monitor->n_sockets++;
+	return monitor_socket;
+}
+
+// Close the socket and free its slot, with io_uring once its receive cancellation is submitted
+static void dropSocket(Monitor_t monitor, struct MonitorSocket * monitor_socket) {
+	if (!monitor->options.io_uring) epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, monitor_socket->fd, NULL);
+	close(monitor_socket->fd);
+	// Events already returned for it are then skipped
+	monitor_socket->fd = monitor_socket->epoll_data.fd = -1;
+	monitor_socket->dumping = false;
+	monitor_socket->dump_due = false;
+}
+
+int addMonitorSocket(Monitor_t monitor, int fd, unsigned int netns) {
+	if (watchSocket(monitor, fd, netns, false) == NULL) return -1;
+	return monitor->options.io_uring ? uringSubmit(&monitor->uring) : 0;
+}
+
+// Look slot's interface up by index, unless replaying, from within its namespace
+static int nameIface(Monitor_t monitor, size_t slot, bool lookup) {
+	unsigned int const netns = monitor->filter.iface_netns[slot];
+	unsigned int const iface = monitor->filter.ifaces[slot];
+	char name[IF_NAMESIZE];
+	// May have gone away since, still report its changes if it comes back
+	if (!lookup || if_indextoname(iface, name) == NULL) snprintf(name, sizeof(name), "%u", iface);
+
+	for (struct IfaceName * entry = monitor->names; entry != NULL; entry = entry->next) {
+		if (entry->netns != netns || entry->ifindex != iface || strcmp(entry->name, name) != 0) continue;
+		monitor->iface_names[slot] = entry->name;
+		return 0;
+	}
+	struct IfaceName * entry = malloc(sizeof(*entry));
+	if (entry == NULL) return -1;
+	entry->netns = netns;
+	entry->ifindex = iface;
+	memcpy(entry->name, name, sizeof(name));
+	entry->next = monitor->names;
+	monitor->names = entry;
+	monitor->iface_names[slot] = entry->name;
+	return 0;
+}
+
+// Namespaces other than our own must have their fd open by now
+static int enterMonitorNetns(Monitor_t monitor, unsigned int netns, int * saved_netns) {
+	int const fd = netns == 0 || monitor->options.netns_fds == NULL ? -1 : monitor->options.netns_fds[netns];
+	if (netns != 0 && fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	return enterNetns(fd, saved_netns);
+}
+
+static int setMembership(int sock, enum rtnetlink_groups group, bool member) {
+	int const option = member ? NETLINK_ADD_MEMBERSHIP : NETLINK_DROP_MEMBERSHIP;
+	return setsockopt(sock, SOL_NETLINK, option, &group, sizeof(group));
+}
+
+// Name the namespace's interfaces that have no name yet
+static int nameNewIfaces(Monitor_t monitor, unsigned int netns) {
+	bool const lookup = !monitor->options.replay;
+	int saved_netns = -1;
+	if (lookup && enterMonitorNetns(monitor, netns, &saved_netns) != 0) return -1;
+	int result = 0;
+	for (size_t slot = 0; slot < monitor->filter.n_ifaces && result == 0; slot++) {
+		if (monitor->filter.iface_netns[slot] != netns || monitor->iface_names[slot] != NULL) continue;
+		result = nameIface(monitor, slot, lookup);
+	}
+	if (leaveNetns(saved_netns) != 0) return -1;
+	return result;
+}
+
+// Sockets are created in their namespace, but are used from any. Names every interface there.
+static int createNetnsSocket(Monitor_t monitor, unsigned int netns, bool * strict_dump) {
+	struct AddrFilter const * filter = &monitor->filter;
+	int saved_netns;
+	if (enterMonitorNetns(monitor, netns, &saved_netns) != 0) return -1;
+
+	for (size_t slot = 0; slot < filter->n_ifaces; slot++) {
+		if (filter->iface_netns[slot] == netns && nameIface(monitor, slot, true) != 0) goto cleanup_netns;
+	}
+
+	int sock = createSocket(filter, netns, monitor->options.kernel_filter);
+	if (sock == -1) goto cleanup_netns;
+	// Fall back to dumping everything on older kernels
+	int const strict = 1;
+	*strict_dump = setsockopt(sock, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &strict, sizeof(strict)) == 0;
+	if (filter->ipv4 && setMembership(sock, RTNLGRP_IPV4_IFADDR, true) == -1) goto cleanup;
+	if (filter->ipv6 && setMembership(sock, RTNLGRP_IPV6_IFADDR, true) == -1) goto cleanup;
+	if (leaveNetns(saved_netns) != 0) {
+		saved_netns = -1;
+		goto cleanup;
+	}
+	return sock;
+
+cleanup:
+	close(sock);
+cleanup_netns:
+	leaveNetns(saved_netns);
+	return -1;
+}
+
+static int openSocket(Monitor_t monitor, unsigned int netns) {
+	bool strict_dump;
+	int sock = createNetnsSocket(monitor, netns, &strict_dump);
+	if (sock == -1) return -1;
+	struct MonitorSocket * monitor_socket = watchSocket(monitor, sock, netns, strict_dump);
+	if (monitor_socket == NULL) {
+		close(sock);
+		return -1;
+	}
+	if (monitor->options.io_uring && uringSubmit(&monitor->uring) != 0) return -1;
+	__atomic_store_n(&monitor->stats.strict_dump, strict_dump, __ATOMIC_RELAXED);
+	return startDump(monitor, monitor_socket);
+}
+
+Monitor_t createMonitor(struct AddrFilter const filter, size_t buf_len, int epoll_fd, Updater_t updater,
+                        struct MonitorOptions options) {
+	struct Monitor * monitor = malloc(sizeof(*monitor));
+	if (monitor == NULL) return NULL;
+	monitor->updater = updater;
+	monitor->epoll_fd = epoll_fd;
+	monitor->timer_fd = -1;
+	monitor->settling = false;
+	monitor->holding = false;
+	monitor->n_sockets = 0;
+	monitor->socket_generation = 0;
+	monitor->names = NULL;
+	monitor->buf = NULL;
+	monitor->uring = (struct Uring) {.fd = -1, .ring = MAP_FAILED, .sqes = MAP_FAILED};
+	monitor->uring_buffers = (struct UringBuffers) {.ring = MAP_FAILED};
+	monitor->uring_msghdr = (struct msghdr) {0};
+	monitor->settle_generation = 0;
+	monitor->options = options;
+	monitor->stats = (struct MonitorStats) {.dump_us = -1, .first_update_us = -1};
+	clock_gettime(CLOCK_MONOTONIC, &monitor->start);
+	for (size_t i = 0; i < NELEMS(monitor->published); i++) {
+		for (size_t j = 0; j < N_FAMILIES; j++) {
+			monitor->candidates[i][j].n = 0;
+			monitor->pending[i][j] = false;
+			monitor->published[i][j].af = AF_UNSPEC;
+		}
+		monitor->dump_due[i] = false;
+	}
+
+	monitor->filter = filter;
+	for (size_t slot = 0; slot < filter.n_ifaces; slot++) {
+		// Replays don't look interfaces up, see openSocket
+		if (nameIface(monitor, slot, false) != 0) goto cleanup;
 	}
 
 	monitor->buf = malloc(buf_len);
 	if (monitor->buf == NULL) goto cleanup;
 	monitor->buf_len = buf_len;
 
-	struct EpollData * data = &monitor->epoll_data;
-	data->tag = EPOLL_MONITOR;
-	data->fd = monitor->socket;
-	data->monitor = monitor;
-	struct epoll_event event = {
-		.events = EPOLLIN,
-		.data = { .ptr = data },
-	};
-	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, monitor->socket, &event) == -1) goto cleanup;
-	monitor->epoll_fd = epoll_fd;
+	if (options.io_uring) {
+		if (createUring(&monitor->uring, URING_ENTRIES) != 0) goto cleanup;
+		if (createUringBuffers(&monitor->uring, &monitor->uring_buffers, URING_BUFFER_GROUP, URING_BUFFERS,
+		                       URING_BUFFER_LEN) != 0) goto cleanup;
 
-	if (requestAddr(&filter, monitor->socket) != 0) goto cleanup;
+		struct EpollData * data = &monitor->uring_data;
+		data->tag = EPOLL_MONITOR_URING;
+		data->fd = monitor->uring.fd;
+		data->monitor = monitor;
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data = { .ptr = data },
+		};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, monitor->uring.fd, &event) == -1) goto cleanup;
+	} else {
+		// Times settling, and offering held changes again
+		monitor->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (monitor->timer_fd == -1) goto cleanup;
+
+		struct EpollData * data = &monitor->timer_data;
+		data->tag = EPOLL_MONITOR_TIMER;
+		data->fd = monitor->timer_fd;
+		data->monitor = monitor;
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data = { .ptr = data },
+		};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, monitor->timer_fd, &event) == -1) goto cleanup;
+	}
+
+	for (unsigned int netns = 0; netns < FILTER_MAX_NETNS && !options.replay; netns++) {
+		if (filterHasNetns(&filter, netns) && openSocket(monitor, netns) != 0) goto cleanup;
+	}
 
 	return monitor;
 
@@ -127,72 +530,595 @@ cleanup:
 }
 
 void destroyMonitor(Monitor_t monitor) {
-	if (monitor->epoll_fd < 0) {
-		epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, monitor->socket, NULL);
+	for (size_t i = 0; i < monitor->n_sockets; i++) {
+		if (monitor->sockets[i].fd < 0) continue;
+		epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, monitor->sockets[i].fd, NULL);
+		close(monitor->sockets[i].fd);
+	}
+	monitor->n_sockets = 0;
+	if (monitor->uring.fd >= 0) {
+		epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, monitor->uring.fd, NULL);
+		// Closing the ring ends its receives before their buffers go
+		destroyUring(&monitor->uring);
 	}
-	if (monitor->socket < 0) {
-		close(monitor->socket);
+	destroyUringBuffers(&monitor->uring_buffers);
+	if (monitor->timer_fd >= 0) {
+		epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, monitor->timer_fd, NULL);
+		close(monitor->timer_fd);
 	}
 	if (monitor->buf != NULL) {
 		monitor->buf_len = 0;
 		free(monitor->buf);
 		monitor->buf = NULL;
 	}
+	while (monitor->names != NULL) {
+		struct IfaceName * next = monitor->names->next;
+		free(monitor->names);
+		monitor->names = next;
+	}
 
 	free(monitor);
 	return;
 }
 
-static int processAddr(Monitor_t monitor, struct nlmsghdr * nlh) {
+static void processAddr(Monitor_t monitor, unsigned int netns, struct nlmsghdr const * nlh) {
 	struct ifaddrmsg * ifa = (struct ifaddrmsg *) NLMSG_DATA(nlh);
-	struct rtattr * addr_attr = filterMessage(&monitor->filter, nlh);
-	if (addr_attr == NULL) return 0;
+	struct FilterResult result;
+	if (!filterMessage(&monitor->filter, netns, nlh, &result)) {
+		count(&monitor->stats.rejected);
+		return;
+	}
+
+	enum AddrFamilySlot const family = familySlot(ifa->ifa_family);
+	struct CandidateSet * set = &monitor->candidates[result.slot][family];
+	struct Candidate candidate = {
+		.addr = addrFromAttr(ifa, result.addr_attr),
+		.temporary = result.flags & IFA_F_TEMPORARY,
+		.flags = result.flags,
+		.preferred_until = UINT64_MAX,
+		.valid_until = UINT64_MAX,
+	};
+	// Selection happens once the batch is in
+	if (!monitor->pending[result.slot][family]) {
+		clock_gettime(CLOCK_MONOTONIC, &monitor->received[result.slot][family]);
+		monitor->pending[result.slot][family] = true;
+	}
+	if (nlh->nlmsg_type == RTM_DELADDR) {
+		candidateRemove(set, &candidate.addr);
+		return;
+	}
 
-	struct IPAddr addr = addrFromAttr(ifa, addr_attr);
-	if (addrEqual(monitor->prev_addr, addr)) return 0;
+	uint64_t const now = monotonicSeconds();
+	if (result.cacheinfo != NULL && result.cacheinfo->ifa_prefered != LIFETIME_FOREVER) {
+		candidate.preferred_until = now + result.cacheinfo->ifa_prefered;
+	}
+	if (result.cacheinfo != NULL && result.cacheinfo->ifa_valid != LIFETIME_FOREVER) {
+		candidate.valid_until = now + result.cacheinfo->ifa_valid;
+	}
+	if (result.flags & IFA_F_DEPRECATED) candidate.preferred_until = 0;
+	candidateUpdate(set, &candidate, now);
+}
+
+int feedMessage(Monitor_t monitor, unsigned int netns, char const * buf, size_t len) {
+	struct nlmsghdr const * nlh;
+	size_t nlmsg_len;
+	for (nlh = (struct nlmsghdr const *) buf, nlmsg_len = len;
+	     NLMSG_OK(nlh, nlmsg_len);
+	     nlh = NLMSG_NEXT(nlh, nlmsg_len)) {
+		struct MonitorSocket * monitor_socket;
+		switch (nlh->nlmsg_type) {
+		case NLMSG_ERROR:
+			errno = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
+			// Interface went away before its dump, its notifications are still watched
+			if (errno != ENODEV || nlh->nlmsg_seq == 0) return -1;
+			// fallthrough
+		case NLMSG_DONE:
+			// Replays have no sockets to send the next dump on
+			monitor_socket = findSocket(monitor, netns);
+			if (monitor_socket != NULL && monitor_socket->dumping && nextDump(monitor, monitor_socket) != 0) return -1;
+			break;
+		case RTM_NEWADDR:
+		case RTM_DELADDR:
+			count(&monitor->stats.delivered);
+			processAddr(monitor, netns, nlh);
+			break;
+		}
+	}
 
-	int result = update(monitor->updater, addr);
+	return 0;
+}
+
+static char const * netnsName(Monitor_t monitor, unsigned int netns) {
+	return netns == 0 || monitor->options.netns_names == NULL ? NULL : monitor->options.netns_names[netns];
+}
+
+static int publish(Monitor_t monitor, size_t slot, struct Candidate const * changed, struct IPAddr previous,
+                   struct timespec received) {
+	struct AddrEvent const event = {
+		.iface = monitor->iface_names[slot],
+		.ifindex = monitor->filter.ifaces[slot],
+		.netns = monitor->filter.iface_netns[slot],
+		.netns_name = netnsName(monitor, monitor->filter.iface_netns[slot]),
+		.addr = changed->addr,
+		.flags = changed->flags,
+		.previous = previous,
+		.ipv4 = monitor->published[slot][FAMILY_IPV4],
+		.ipv6 = monitor->published[slot][FAMILY_IPV6],
+		.combined = monitor->options.combine_families,
+		.received = received,
+	};
+	int result = update(monitor->updater, &event);
 	if (result != 0) return result;
-	monitor->prev_addr = addr;
+	if (monitor->stats.first_update_us < 0) {
+		__atomic_store_n(&monitor->stats.first_update_us, elapsedUs(monitor->start), __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+static int holdPending(Monitor_t monitor);
+
+static int flushPending(Monitor_t monitor) {
+	uint64_t const now = monotonicSeconds();
+	bool held = false;
+	for (size_t slot = 0; slot < monitor->filter.n_ifaces; slot++) {
+		struct Candidate const * changed = NULL;
+		struct IPAddr previous;
+		struct timespec received;
+		// To put back if the updater can't take the change yet
+		struct IPAddr before[N_FAMILIES];
+		bool was_pending[N_FAMILIES];
+		memcpy(before, monitor->published[slot], sizeof(before));
+		memcpy(was_pending, monitor->pending[slot], sizeof(was_pending));
+		for (size_t family = 0; family < N_FAMILIES; family++) {
+			if (!monitor->pending[slot][family]) continue;
+			monitor->pending[slot][family] = false;
+			struct IPAddr * current = &monitor->published[slot][family];
+			struct Candidate const * selected = candidateSelect(&monitor->candidates[slot][family], current, now);
+			// With no address left, the last one stays published
+			if (selected == NULL || addrEqual(*current, selected->addr)) {
+				count(&monitor->stats.deduped);
+				continue;
+			}
+			previous = *current;
+			*current = selected->addr;
+			// A combined update is as late as its earliest change
+			if (changed == NULL || timespecBefore(monitor->received[slot][family], received)) {
+				received = monitor->received[slot][family];
+			}
+			changed = selected;
+			if (!monitor->options.combine_families) {
+				int result = publish(monitor, slot, changed, previous, monitor->received[slot][family]);
+				if (result == UPDATE_BUSY) {
+					*current = previous;
+					monitor->pending[slot][family] = true;
+					held = true;
+				} else if (result != 0) {
+					return result;
+				}
+			}
+		}
+		// Once both families of the batch are in
+		if (monitor->options.combine_families && changed != NULL) {
+			int result = publish(monitor, slot, changed, previous, received);
+			if (result == UPDATE_BUSY) {
+				memcpy(monitor->published[slot], before, sizeof(before));
+				memcpy(monitor->pending[slot], was_pending, sizeof(was_pending));
+				held = true;
+			} else if (result != 0) {
+				return result;
+			}
+		}
+	}
+	monitor->holding = held;
+	return held ? holdPending(monitor) : 0;
+}
+
+// Queue the removal of the current settle timeout, its completion is then stale
+static int cancelUringSettle(Monitor_t monitor) {
+	struct io_uring_sqe * sqe = uringSqe(&monitor->uring);
+	if (sqe == NULL) {
+		errno = EBUSY;
+		return -1;
+	}
+	sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = URING_SETTLE | monitor->settle_generation;
+	sqe->user_data = URING_IGNORE;
+	monitor->settle_generation++;
 	return 0;
 }
 
-int processMessage(Monitor_t monitor, int fd, int32_t events) {
-	ssize_t len = recv(fd, monitor->buf, monitor->buf_len, MSG_TRUNC);
-	if (len == -1) {
-		// Error reading socket
+static int armUringSettle(Monitor_t monitor, struct timespec deadline, bool armed) {
+	if (armed && cancelUringSettle(monitor) != 0) return -1;
+	struct io_uring_sqe * sqe = uringSqe(&monitor->uring);
+	if (sqe == NULL) {
+		errno = EBUSY;
 		return -1;
-	} else if (len == 0) {
+	}
+	monitor->settle_deadline = (struct __kernel_timespec) {.tv_sec = deadline.tv_sec, .tv_nsec = deadline.tv_nsec};
+	// A pure timer, absolute on CLOCK_MONOTONIC
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t) &monitor->settle_deadline;
+	sqe->len = 1;
+	sqe->timeout_flags = IORING_TIMEOUT_ABS;
+	sqe->user_data = URING_SETTLE | monitor->settle_generation;
+	return uringSubmit(&monitor->uring);
+}
+
+// (Re)start the settle timer, without pushing it past the max delay
+static int armSettle(Monitor_t monitor) {
+	bool pending = false;
+	for (size_t slot = 0; slot < monitor->filter.n_ifaces && !pending; slot++) {
+		for (size_t family = 0; family < N_FAMILIES; family++) {
+			pending |= monitor->pending[slot][family];
+		}
+	}
+	if (!pending) return 0;
+
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+	bool const armed = monitor->settling;
+	if (!monitor->settling) {
+		monitor->settling = true;
+		monitor->settle_start = now;
+		// Lets the updater connect while waiting
+		if (prepareUpdater(monitor->updater) != 0) return -1;
+	}
+
+	struct timespec deadline = timespecAddMs(now, monitor->options.settle_ms);
+	struct timespec max_deadline = timespecAddMs(monitor->settle_start, monitor->options.max_delay_ms);
+	if (timespecBefore(max_deadline, deadline)) deadline = max_deadline;
+
+	if (monitor->options.io_uring) return armUringSettle(monitor, deadline, armed);
+	struct itimerspec timer = { .it_value = deadline };
+	return timerfd_settime(monitor->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+// Offer changes the updater turned away again shortly, it has fallen behind
+static int holdPending(Monitor_t monitor) {
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+	bool const armed = monitor->settling;
+	if (!monitor->settling) {
+		monitor->settling = true;
+		monitor->settle_start = now;
+	}
+
+	struct timespec const deadline = timespecAddMs(now, MONITOR_RETRY_MS);
+	if (monitor->options.io_uring) return armUringSettle(monitor, deadline, armed);
+	struct itimerspec timer = { .it_value = deadline };
+	return timerfd_settime(monitor->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+// Changes were lost, so re-request, unless a dump is underway anyway
+static int recoverOverrun(Monitor_t monitor, struct MonitorSocket * monitor_socket) {
+	count(&monitor->stats.overruns);
+	return monitor_socket->dumping ? 0 : startDump(monitor, monitor_socket);
+}
+
+// Whether the socket dropped datagrams since last asked, as ENOBUFS from a receive is also what
+// running out of io_uring buffers looks like
+static int socketOverran(struct MonitorSocket * monitor_socket, bool * overran) {
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+	if (getsockopt(monitor_socket->fd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == -1) return -1;
+	*overran = meminfo[SK_MEMINFO_DROPS] != monitor_socket->drops;
+	monitor_socket->drops = meminfo[SK_MEMINFO_DROPS];
+	return 0;
+}
+
+int processMessage(Monitor_t monitor, int fd, __attribute__((unused)) int32_t events) {
+	// Closed by a reconfiguration earlier in the batch
+	if (fd < 0) return 0;
+	struct MonitorSocket * monitor_socket = NULL;
+	for (size_t i = 0; i < monitor->n_sockets; i++) {
+		if (monitor->sockets[i].fd == fd) monitor_socket = &monitor->sockets[i];
+	}
+	unsigned int const netns = monitor_socket != NULL ? monitor_socket->netns : 0;
+
+	// Drain what has queued up, so a burst of changes costs a single update
+	for (size_t i = 0; i < MONITOR_MAX_BATCH; i++) {
+		ssize_t len = recv(fd, monitor->buf, monitor->buf_len, MSG_TRUNC | MSG_DONTWAIT);
+		count(&monitor->stats.syscalls);
+		if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		} else if (len == -1 && errno == ENOBUFS && monitor_socket != NULL) {
+			// The socket overran, what it still holds is read on
+			if (recoverOverrun(monitor, monitor_socket) != 0) return -1;
+		} else if (len == -1) {
+			// Error reading socket
+			return -1;
+		} else if (len == 0) {
+			// Closed by kernel
+			return -2;
+		} else if ((size_t) len > monitor->buf_len) {
+			count(&monitor->stats.regrowths);
+			free(monitor->buf);
+			monitor->buf = malloc(len);
+			if (monitor->buf == NULL) return -1;
+			monitor->buf_len = (size_t) len;
+
+			// clear socket, else get EBUSY on requestAddr
+			while (recv(fd, monitor->buf, monitor->buf_len, MSG_DONTWAIT) != -1) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+			// May have missed data, re-request. Any dump underway was drained too.
+			if (monitor_socket != NULL) monitor_socket->dumping = false;
+			if (monitor_socket != NULL && startDump(monitor, monitor_socket) != 0) return -1;
+			break;
+		}
+		PROBE(netlink__receive, netns, len);
+
+		if (monitor->options.record != NULL
+		    && recordDatagram(monitor->options.record, netns, monitor->buf, (size_t) len) != 0) return -1;
+		if (feedMessage(monitor, netns, monitor->buf, (size_t) len) != 0) return -1;
+	}
+
+	return finishBatch(monitor);
+}
+
+static int completeReceive(Monitor_t monitor, struct io_uring_cqe const * cqe) {
+	size_t const index = cqe->user_data & ((1U << URING_INDEX_BITS) - 1);
+	struct MonitorSocket * monitor_socket = &monitor->sockets[index];
+	// Of a socket closed since, whose receive was cancelled
+	if (index >= monitor->n_sockets || monitor_socket->fd < 0
+	    || (uint32_t) cqe->user_data >> URING_INDEX_BITS != monitor_socket->generation) {
+		if (cqe->flags & IORING_CQE_F_BUFFER) {
+			uringRecycle(&monitor->uring_buffers, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		}
+		return 0;
+	}
+	// Ran out of buffers or hit an error, which ends the multishot
+	if (!(cqe->flags & IORING_CQE_F_MORE) && armReceive(monitor, index) != 0) return -1;
+	if (cqe->res == -ENOBUFS) {
+		// Either no buffer was free, and the datagram waits in the socket for the receive re-armed
+		// above, or the socket overran and changes were lost. Only the kernel's count of drops tells.
+		bool overran;
+		if (socketOverran(monitor_socket, &overran) != 0) return -1;
+		return overran ? recoverOverrun(monitor, monitor_socket) : 0;
+	} else if (cqe->res < 0) {
+		errno = -cqe->res;
+		return -1;
+	} else if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
 		// Closed by kernel
 		return -2;
-	} else if ((size_t) len > monitor->buf_len) {
-		free(monitor->buf);
-		monitor->buf = malloc(len);
-		monitor->buf_len = (size_t) len;
+	}
 
-		// clear socket, else get EBUSY on requestAddr
-		while (recv(fd, monitor->buf, monitor->buf_len, MSG_DONTWAIT) != -1) continue;
-		if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+	uint16_t const id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	char const * buf = uringBuffer(&monitor->uring_buffers, id);
+	struct io_uring_recvmsg_out const * out = (struct io_uring_recvmsg_out const *) buf;
+	// No name or control data was asked for
+	size_t const len = cqe->res - sizeof(*out);
+	int result = 0;
+	if (out->flags & MSG_TRUNC) {
+		// Buffers can't grow while the kernel holds them, but re-dumps fit
+		count(&monitor->stats.regrowths);
+		if (!monitor_socket->dumping) result = startDump(monitor, monitor_socket);
+	} else {
+		PROBE(netlink__receive, monitor_socket->netns, len);
+		if (monitor->options.record != NULL) {
+			result = recordDatagram(monitor->options.record, monitor_socket->netns, buf + sizeof(*out), len);
+		}
+		if (result == 0) result = feedMessage(monitor, monitor_socket->netns, buf + sizeof(*out), len);
+	}
+	uringRecycle(&monitor->uring_buffers, id);
+	return result;
+}
 
-		// May have missed data, re-request
-		return requestAddr(&monitor->filter, fd);
+static int completeSettle(Monitor_t monitor, struct io_uring_cqe const * cqe) {
+	// Replaced since, or cancelled
+	if ((uint32_t) cqe->user_data != monitor->settle_generation) return 0;
+	if (cqe->res != -ETIME) {
+		errno = -cqe->res;
+		return -1;
 	}
+	monitor->settle_generation++;
+	monitor->settling = false;
+	return flushPending(monitor);
+}
 
-	struct nlmsghdr * nlh;
-	size_t nlmsg_len;
-	for (nlh = (struct nlmsghdr*) monitor->buf, nlmsg_len = monitor->buf_len;
-	     NLMSG_OK(nlh, nlmsg_len) && nlh->nlmsg_type != NLMSG_DONE;
-	     nlh = NLMSG_NEXT(nlh, nlmsg_len)) {
-		switch (nlh->nlmsg_type) {
-		case NLMSG_ERROR:
-			errno = -((struct nlmsgerr *) NLMSG_DATA(nlh))->error;
-			return  -1;
-		case RTM_NEWADDR: {
-			int result = processAddr(monitor, nlh);
-			if (result != 0) return result;
+int processUring(Monitor_t monitor, __attribute__((unused)) int fd, __attribute__((unused)) int32_t events) {
+	// Completions don't need a syscall, only re-arming does. Woken with none posted yet, they wait on us.
+	if (uringPeek(&monitor->uring) == NULL && uringRunTaskWork(&monitor->uring) != 0) return -1;
+	struct io_uring_cqe const * peeked;
+	bool received = false;
+	while ((peeked = uringPeek(&monitor->uring)) != NULL) {
+		struct io_uring_cqe const cqe = *peeked;
+		uringSeen(&monitor->uring);
+		int result = 0;
+		switch (cqe.user_data & URING_OP_MASK) {
+		case URING_RECEIVE:
+			result = completeReceive(monitor, &cqe);
+			received = true;
 			break;
-		}}
+		case URING_SETTLE:
+			result = completeSettle(monitor, &cqe);
+			break;
+		}
+		if (result != 0) return result;
 	}
 
-	return 0;
+	// Timer completions alone mustn't restart settling
+	if (received && finishBatch(monitor) != 0) return -1;
+	return uringSubmit(&monitor->uring);
+}
+
+int finishBatch(Monitor_t monitor) {
+	if (monitor->options.record != NULL && fflush(monitor->options.record) != 0) return -1;
+	if (monitor->options.settle_ms == 0) return flushPending(monitor);
+	return armSettle(monitor);
+}
+
+int flushMonitor(Monitor_t monitor) {
+	if (monitor->settling && monitor->options.io_uring) {
+		if (cancelUringSettle(monitor) != 0 || uringSubmit(&monitor->uring) != 0) return -1;
+		monitor->settling = false;
+	} else if (monitor->settling) {
+		struct itimerspec disarm = {0};
+		if (timerfd_settime(monitor->timer_fd, 0, &disarm, NULL) == -1) return -1;
+		monitor->settling = false;
+	}
+	return flushPending(monitor);
+}
+
+int processTimeout(Monitor_t monitor, int fd, __attribute__((unused)) int32_t events) {
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return -1;
+
+	monitor->settling = false;
+	return flushPending(monitor);
+}
+
+// Puts back what reconfigureMonitor changed on existing sockets
+static void restoreSocket(Monitor_t monitor, struct MonitorSocket const * monitor_socket,
+                          struct AddrFilter const * filter) {
+	bool const families[N_FAMILIES] = {filter->ipv4, filter->ipv6};
+	if (monitor->options.kernel_filter) filterAttach(filter, monitor_socket->netns, monitor_socket->fd);
+	setMembership(monitor_socket->fd, RTNLGRP_IPV4_IFADDR, families[FAMILY_IPV4]);
+	setMembership(monitor_socket->fd, RTNLGRP_IPV6_IFADDR, families[FAMILY_IPV6]);
+}
+
+int reconfigureMonitor(Monitor_t monitor, struct AddrFilter const filter) {
+	// The new state is built in next, and only replaces the monitor's once nothing can fail
+	struct Monitor * next = malloc(sizeof(*next));
+	if (next == NULL) return -1;
+	*next = *monitor;
+	struct AddrFilter const * old_filter = &monitor->filter;
+	bool const replay = monitor->options.replay;
+	bool const families[N_FAMILIES] = {filter.ipv4, filter.ipv6};
+	bool const old_families[N_FAMILIES] = {old_filter->ipv4, old_filter->ipv6};
+	// Addresses dropped so far may be allowed now, or the other way round, so start over from a dump.
+	// Replays can't, and keep what they have.
+	bool const redump = !replay && (filter.allow_private != old_filter->allow_private
+	                                || filter.allow_temporary != old_filter->allow_temporary);
+	next->filter = filter;
+
+	// Carry over what is known of interfaces still monitored, which may be in other slots now
+	for (size_t slot = 0; slot < filter.n_ifaces; slot++) {
+		int const old_slot = filterIfaceSlot(old_filter, filter.iface_netns[slot], filter.ifaces[slot]);
+		next->iface_names[slot] = old_slot >= 0 ? monitor->iface_names[old_slot] : NULL;
+		next->dump_due[slot] = false;
+		for (size_t family = 0; family < N_FAMILIES; family++) {
+			bool const known = old_slot >= 0 && families[family] && old_families[family];
+			next->published[slot][family] = known ? monitor->published[old_slot][family]
+				: (struct IPAddr) {.af = AF_UNSPEC};
+			next->pending[slot][family] = known && monitor->pending[old_slot][family];
+			next->received[slot][family] = old_slot >= 0 ? monitor->received[old_slot][family] : (struct timespec) {0};
+			next->candidates[slot][family].n = 0;
+			if (known && !redump) next->candidates[slot][family] = monitor->candidates[old_slot][family];
+			// Published stays, so an unchanged choice isn't sent again
+			else if (families[family] && !replay) next->dump_due[slot] = true;
+		}
+	}
+
+	// Sockets are opened and changed in place, and undone on failure
+	size_t const n_sockets = monitor->n_sockets;
+	bool opened[FILTER_MAX_NETNS] = {false}, updated[FILTER_MAX_NETNS] = {false};
+	bool removed[FILTER_MAX_NETNS] = {false}, strict_dump[FILTER_MAX_NETNS];
+	int result = -1;
+	for (unsigned int netns = 0; netns < FILTER_MAX_NETNS; netns++) {
+		bool const wanted = filterHasNetns(&filter, netns);
+		struct MonitorSocket * monitor_socket = findSocket(monitor, netns);
+		if (monitor_socket == NULL && wanted && !replay) {
+			// Names every interface there
+			bool strict;
+			int const sock = createNetnsSocket(next, netns, &strict);
+			if (sock == -1) goto cleanup;
+			monitor_socket = watchSocket(monitor, sock, netns, strict);
+			if (monitor_socket == NULL) {
+				close(sock);
+				goto cleanup;
+			}
+			size_t const index = monitor_socket - monitor->sockets;
+			opened[index] = true;
+			strict_dump[index] = strict;
+			continue;
+		}
+
+		bool unnamed = false;
+		for (size_t slot = 0; slot < filter.n_ifaces; slot++) {
+			unnamed |= filter.iface_netns[slot] == netns && next->iface_names[slot] == NULL;
+		}
+		if (unnamed && nameNewIfaces(next, netns) != 0) goto cleanup;
+		if (monitor_socket == NULL) continue;
+
+		size_t const index = monitor_socket - monitor->sockets;
+		// Replays don't open sockets, so keep theirs
+		if (!wanted && !replay) {
+			if (monitor->options.io_uring && cancelReceive(monitor, index) != 0) goto cleanup;
+			removed[index] = true;
+			continue;
+		}
+		updated[index] = true;
+		// Also in namespaces left without interfaces, whose notifications are now all dropped
+		if (monitor->options.kernel_filter && filterAttach(&filter, netns, monitor_socket->fd) != 0) goto cleanup;
+		if (families[FAMILY_IPV4] != old_families[FAMILY_IPV4]
+		    && setMembership(monitor_socket->fd, RTNLGRP_IPV4_IFADDR, families[FAMILY_IPV4]) != 0) goto cleanup;
+		if (families[FAMILY_IPV6] != old_families[FAMILY_IPV6]
+		    && setMembership(monitor_socket->fd, RTNLGRP_IPV6_IFADDR, families[FAMILY_IPV6]) != 0) goto cleanup;
+	}
+	if (monitor->options.io_uring && uringSubmit(&monitor->uring) != 0) goto cleanup;
+
+	monitor->filter = next->filter;
+	memcpy(monitor->iface_names, next->iface_names, sizeof(monitor->iface_names));
+	memcpy(monitor->dump_due, next->dump_due, sizeof(monitor->dump_due));
+	memcpy(monitor->published, next->published, sizeof(monitor->published));
+	memcpy(monitor->candidates, next->candidates, sizeof(monitor->candidates));
+	memcpy(monitor->pending, next->pending, sizeof(monitor->pending));
+	memcpy(monitor->received, next->received, sizeof(monitor->received));
+	for (size_t i = 0; i < monitor->n_sockets; i++) {
+		if (removed[i]) dropSocket(monitor, &monitor->sockets[i]);
+	}
+
+	// Dump requests can't be taken back, so come last. Failing one is still an error, with the new
+	// filter in place.
+	result = 0;
+	for (size_t i = 0; i < monitor->n_sockets && result == 0; i++) {
+		struct MonitorSocket * monitor_socket = &monitor->sockets[i];
+		if (opened[i]) {
+			__atomic_store_n(&monitor->stats.strict_dump, strict_dump[i], __ATOMIC_RELAXED);
+			result = startDump(monitor, monitor_socket);
+		} else if (updated[i]) {
+			for (size_t slot = 0; slot < filter.n_ifaces; slot++) {
+				monitor_socket->dump_due |= filter.iface_netns[slot] == monitor_socket->netns
+				                            && monitor->dump_due[slot];
+			}
+			if (!monitor_socket->dumping) result = nextDump(monitor, monitor_socket);
+		}
+	}
+	goto done;
+
+cleanup:
+	if (monitor->options.io_uring) uringDiscard(&monitor->uring);
+	for (size_t i = 0; i < monitor->n_sockets; i++) {
+		if (updated[i]) restoreSocket(monitor, &monitor->sockets[i], old_filter);
+		if (opened[i]) dropSocket(monitor, &monitor->sockets[i]);
+	}
+	monitor->n_sockets = n_sockets;
+done:
+	// Interfaces named on the way are kept until destroyMonitor
+	monitor->names = next->names;
+	free(next);
+	return result;
+}
+
+bool monitorHolding(Monitor_t monitor) {
+	return monitor->holding;
+}
+
+struct MonitorStats monitorStats(Monitor_t monitor) {
+	struct MonitorStats const * stats = &monitor->stats;
+	return (struct MonitorStats) {
+		.delivered = __atomic_load_n(&stats->delivered, __ATOMIC_RELAXED),
+		.rejected = __atomic_load_n(&stats->rejected, __ATOMIC_RELAXED),
+		.deduped = __atomic_load_n(&stats->deduped, __ATOMIC_RELAXED),
+		.regrowths = __atomic_load_n(&stats->regrowths, __ATOMIC_RELAXED),
+		.overruns = __atomic_load_n(&stats->overruns, __ATOMIC_RELAXED),
+		.syscalls = __atomic_load_n(&stats->syscalls, __ATOMIC_RELAXED)
+		            + __atomic_load_n(&monitor->uring.syscalls, __ATOMIC_RELAXED),
+		.strict_dump = __atomic_load_n(&stats->strict_dump, __ATOMIC_RELAXED),
+		.dump_us = __atomic_load_n(&stats->dump_us, __ATOMIC_RELAXED),
+		.first_update_us = __atomic_load_n(&stats->first_update_us, __ATOMIC_RELAXED),
+	};
 }
@@ -2,11 +2,77 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "filter.h"
 #include "updater.h"
 
+struct MonitorOptions {
+	// Drop uninteresting notifications in the kernel with a BPF socket filter
+	bool kernel_filter;
+	// Wait for addresses to be stable this long before updating, 0 to update immediately
+	unsigned int settle_ms;
+	// Update after at most this long, even if addresses keep changing
+	unsigned int max_delay_ms;
+	// One update per interface carrying both families, rather than one per family
+	bool combine_families;
+	// Append every datagram received to this recording, if not NULL
+	FILE * record;
+	// Don't open a netlink socket, messages are fed in with feedMessage
+	bool replay;
+	// Receive with multishot recvmsg and time settling on an io_uring (Linux 6.0+), whose fd
+	// is polled by epoll in place of the sockets and timer
+	bool io_uring;
+	// Namespace file descriptors and names, indexed by the filter's netns numbers. Entry 0
+	// is unused as it is our own, may be NULL if only that one is monitored.
+	int const * netns_fds;
+	char const * const * netns_names;
+};
+
+struct MonitorStats {
+	// Netlink messages the kernel let through to userspace
+	unsigned long long delivered;
+	// Of those, messages filterMessage() then threw away
+	unsigned long long rejected;
+	// Changes that left the published address as it was
+	unsigned long long deduped;
+	// Datagrams too big for the buffer, which is grown and the addresses re-dumped
+	unsigned long long regrowths;
+	// Times the socket ran out of room and dropped changes, which are then re-dumped
+	unsigned long long overruns;
+	// Syscalls spent receiving: recv(), or io_uring_enter() with io_uring
+	unsigned long long syscalls;
+	// Whether the kernel filtered the initial dump by interface
+	bool strict_dump;
+	// Since createMonitor, -1 until it happens
+	long long dump_us;
+	long long first_update_us;
+};
+
 typedef struct Monitor * Monitor_t;
-Monitor_t createMonitor(struct AddrFilter const filter, size_t buf_len, int epoll_fd, Updater_t updater);
+Monitor_t createMonitor(struct AddrFilter const filter, size_t buf_len, int epoll_fd, Updater_t updater,
+                        struct MonitorOptions options);
 int processMessage(Monitor_t monitor, int fd, int32_t events);
+int processTimeout(Monitor_t monitor, int fd, int32_t events);
+// Reap the io_uring's completions
+int processUring(Monitor_t monitor, int fd, int32_t events);
+// Receive from a socket opened elsewhere as from netns's netlink socket, without dumping.
+// It is closed by destroyMonitor.
+int addMonitorSocket(Monitor_t monitor, int fd, unsigned int netns);
+// Process a datagram read elsewhere, changes are held until finishBatch
+int feedMessage(Monitor_t monitor, unsigned int netns, char const * buf, size_t len);
+// Publish the batch's changes, or wait for them to settle
+int finishBatch(Monitor_t monitor);
+// Publish pending changes now, even if still settling
+int flushMonitor(Monitor_t monitor);
+// Switch to filter's interfaces and rules, keeping what is known of interfaces still monitored.
+// Only interfaces new to the monitor are dumped, unless the rules for which addresses to
+// consider changed. Namespaces in filter must have fds in options.netns_fds by now, those no
+// longer in it have their sockets closed. On failure the monitor carries on as it was, except
+// when a dump can't be requested once switched over.
+int reconfigureMonitor(Monitor_t monitor, struct AddrFilter const filter);
+// Changes are pending that the updater had no room for, and will be offered again
+bool monitorHolding(Monitor_t monitor);
+// Safe to call from any thread
+struct MonitorStats monitorStats(Monitor_t monitor);
 void destroyMonitor(Monitor_t monitor);
@@ -0,0 +1,48 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "netns.h"
+
+int openNetns(char const * spec) {
+	char path[PATH_MAX];
+	bool const is_pid = spec[0] != '\0' && strspn(spec, "0123456789") == strlen(spec);
+	int len = is_pid
+		? snprintf(path, sizeof(path), "/proc/%s/ns/net", spec)
+		: snprintf(path, sizeof(path), "/var/run/netns/%s", spec);
+	if (len < 0 || (size_t) len >= sizeof(path) || (!is_pid && strchr(spec, '/') != NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+int enterNetns(int netns_fd, int * saved_fd) {
+	*saved_fd = -1;
+	if (netns_fd < 0) return 0;
+
+	// The calling thread's, which differs from the process's while another thread is inside one
+	*saved_fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (*saved_fd == -1) return -1;
+	if (setns(netns_fd, CLONE_NEWNET) == -1) {
+		close(*saved_fd);
+		*saved_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int leaveNetns(int saved_fd) {
+	if (saved_fd < 0) return 0;
+	int result = setns(saved_fd, CLONE_NEWNET);
+	int const setns_errno = errno;
+	close(saved_fd);
+	errno = setns_errno;
+	return result;
+}
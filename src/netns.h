@@ -0,0 +1,8 @@
+#pragma once
+
+// Network namespaces are given as a name under /var/run/netns or a pid
+int openNetns(char const * spec);
+// Switch this thread to netns_fd, saving the current namespace in *saved_fd.
+// A negative netns_fd means the current namespace, and does nothing.
+int enterNetns(int netns_fd, int * saved_fd);
+int leaveNetns(int saved_fd);
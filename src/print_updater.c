@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <linux/if_addr.h>
+
+#include "print_updater.h"
+#include "util.h"
+
+static struct {
+	uint32_t flag;
+	char const * name;
+} const flag_names[] = {
+	// IFA_F_TEMPORARY for IPv6, see flagName
+	{IFA_F_SECONDARY, "secondary"},
+	{IFA_F_NODAD, "nodad"},
+	{IFA_F_OPTIMISTIC, "optimistic"},
+	{IFA_F_DADFAILED, "dadfailed"},
+	{IFA_F_HOMEADDRESS, "homeaddress"},
+	{IFA_F_DEPRECATED, "deprecated"},
+	{IFA_F_TENTATIVE, "tentative"},
+	{IFA_F_PERMANENT, "permanent"},
+	{IFA_F_MANAGETEMPADDR, "mngtmpaddr"},
+	{IFA_F_NOPREFIXROUTE, "noprefixroute"},
+	{IFA_F_MCAUTOJOIN, "autojoin"},
+	{IFA_F_STABLE_PRIVACY, "stable-privacy"},
+};
+
+// The same bit means secondary for IPv4 and temporary for IPv6
+static char const * flagName(size_t i, unsigned char af) {
+	if (flag_names[i].flag == IFA_F_TEMPORARY && af == AF_INET6) return "temporary";
+	return flag_names[i].name;
+}
+
+Updater_t createPrintUpdater(struct PrintUpdaterOptions options) {
+	Updater_t updater = malloc(sizeof(*updater));
+	if (updater == NULL) return NULL;
+	updater->tag = PRINT_UPDATER;
+	updater->print.options = options;
+	updater->print.stats = (struct UpdaterStats) {0};
+	updater->print.len = 0;
+	return updater;
+}
+
+// Interface names can hold anything but '/', ':' and whitespace
+static char * putEscaped(char * p, char const * str) {
+	for (; *str != '\0'; str++) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = c;
+		} else if (c < 0x20) {
+			p += sprintf(p, "\\u%04x", c);
+		} else {
+			*p++ = c;
+		}
+	}
+	return p;
+}
+
+// Returns the end of the line, which holds at most PRINT_MAX_LINE bytes
+static char * formatJson(char * p, struct AddrEvent const * event) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	struct tm tm;
+	gmtime_r(&now.tv_sec, &tm);
+	p += strftime(p, 32, "{\"time\":\"%Y-%m-%dT%H:%M:%S", &tm);
+	p += sprintf(p, ".%06ldZ\",\"event\":\"%s\",\"iface\":\"", now.tv_nsec / 1000,
+	             event->previous.af == AF_UNSPEC ? "new" : "change");
+	p = putEscaped(p, event->iface);
+	p += sprintf(p, "\",\"ifindex\":%u,\"family\":\"%s\",\"address\":\"", event->ifindex,
+	             event->addr.af == AF_INET ? "inet" : "inet6");
+	p += formatAddr(&event->addr, p);
+	p += sprintf(p, "\",\"prefixlen\":%u,\"flags\":[", event->addr.prefixlen);
+	bool first = true;
+	for (size_t i = 0; i < NELEMS(flag_names); i++) {
+		if (!(event->flags & flag_names[i].flag)) continue;
+		p += sprintf(p, first ? "\"%s\"" : ",\"%s\"", flagName(i, event->addr.af));
+		first = false;
+	}
+	*p++ = ']';
+	if (event->previous.af != AF_UNSPEC) {
+		p += sprintf(p, ",\"previous\":\"");
+		p += formatAddr(&event->previous, p);
+		*p++ = '"';
+	}
+	*p++ = '}';
+	*p++ = '\n';
+	return p;
+}
+
+int flushPrintUpdater(struct PrintUpdater * updater) {
+	size_t written = 0;
+	while (written < updater->len) {
+		ssize_t n = write(updater->options.fd, updater->buf + written, updater->len - written);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) return -1;
+		written += n;
+	}
+	updater->len = 0;
+	return 0;
+}
+
+int printUpdate(struct PrintUpdater * updater, struct AddrEvent const * event) {
+	updater->stats.issued++;
+	if (!updater->options.json) {
+		if (printAddr(event->addr) != 0) {
+			updater->stats.failed++;
+			return -1;
+		}
+	} else {
+		if (PRINT_BUFFER - updater->len < PRINT_MAX_LINE && flushPrintUpdater(updater) != 0) {
+			updater->stats.failed++;
+			return -1;
+		}
+		updater->len = formatJson(updater->buf + updater->len, event) - updater->buf;
+	}
+	updater->stats.succeeded++;
+	observeLatency(&updater->stats, event->received);
+	return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "ipaddr.h"
+#include "stats.h"
+
+// JSON lines are collected here, and written out once per batch of events
+#define PRINT_BUFFER 4096
+// Longest JSON line, flags and escaping included
+#define PRINT_MAX_LINE 512
+
+struct PrintUpdaterOptions {
+	// One JSON object per line, rather than bare addresses on stdout
+	bool json;
+	// Where JSON lines are written
+	int fd;
+};
+
+struct PrintUpdater {
+	struct PrintUpdaterOptions options;
+	struct UpdaterStats stats;
+	char buf[PRINT_BUFFER];
+	size_t len;
+};
+
+int printUpdate(struct PrintUpdater * updater, struct AddrEvent const * event);
+// Write out buffered lines
+int flushPrintUpdater(struct PrintUpdater * updater);
+
+#include "updater.h"
+
+Updater_t createPrintUpdater(struct PrintUpdaterOptions options);
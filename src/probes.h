@@ -0,0 +1,32 @@
+#pragma once
+
+// USDT probes for bpftrace and perf, in provider "dyndns". Built in with
+// -Dwith-usdt=true, otherwise they compile to nothing.
+//
+// Arguments are evaluated whether anything is attached or not, so they are
+// only what's at hand. Tracers take the time themselves: bpftrace's nsecs is
+// CLOCK_MONOTONIC, as is received below. Probes about an address take its
+// ifindex, family and a pointer to its 4 or 16 bytes:
+//
+//   netlink__receive(netns, len)          datagram read in processMessage
+//   filter__accept(ifindex, af, addr)     filterMessage kept an address
+//   filter__reject(ifindex, af, addr)     ... or dropped it, addr may be NULL
+//   update(ifindex, af, addr, received)   handed to the updater, behind the queue
+//                                         when threaded. received is when the
+//                                         change came from netlink, in ns.
+//   web__submit(ifindex, af, addr, url)   request started
+//   web__complete(ifindex, af, addr, url, curl_code, http_status)
+
+#ifdef WITH_USDT
+#include <stdint.h>
+#include <time.h>
+#include <sys/sdt.h>
+
+static inline uint64_t probeTimestamp(struct timespec t) {
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+#define PROBE(name, ...) STAP_PROBEV(dyndns, name, __VA_ARGS__)
+#else
+#define PROBE(name, ...) do {} while (0)
+#endif /*WITH_USDT*/
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "queue.h"
+
+int createQueue(struct EventQueue * queue) {
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+	atomic_init(&queue->closed, false);
+	atomic_init(&queue->result, 0);
+	atomic_init(&queue->prepare, false);
+	queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return queue->event_fd == -1 ? -1 : 0;
+}
+
+void destroyQueue(struct EventQueue * queue) {
+	if (queue->event_fd >= 0) close(queue->event_fd);
+	queue->event_fd = -1;
+}
+
+static int wake(struct EventQueue * queue) {
+	uint64_t one = 1;
+	// EAGAIN means the counter is saturated, it's woken anyway
+	if (write(queue->event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) return -1;
+	return 0;
+}
+
+int closeQueue(struct EventQueue * queue, int result) {
+	atomic_store_explicit(&queue->result, result, memory_order_relaxed);
+	atomic_store_explicit(&queue->closed, true, memory_order_release);
+	return wake(queue);
+}
+
+int drainQueue(struct EventQueue * queue, Updater_t updater) {
+	uint64_t count;
+	if (read(queue->event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) return -1;
+
+	// Checked before emptying, so nothing pushed before closing is missed
+	bool const closed = atomic_load_explicit(&queue->closed, memory_order_acquire);
+	if (atomic_exchange_explicit(&queue->prepare, false, memory_order_relaxed) && prepareUpdater(updater) != 0) {
+		return -1;
+	}
+	size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	size_t const tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	for (; head != tail; head++) {
+		int result = update(updater, &queue->events[head & (QUEUE_SIZE - 1)]);
+		// Free the slot before bailing out, the event is done with either way
+		atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+		if (result != 0) return result;
+	}
+	return closed ? 1 : 0;
+}
+
+Updater_t createQueueUpdater(struct EventQueue * queue) {
+	Updater_t updater = malloc(sizeof(*updater));
+	if (updater == NULL) return NULL;
+	updater->tag = QUEUE_UPDATER;
+	updater->queue.queue = queue;
+	updater->queue.pushed = false;
+	updater->queue.full = false;
+	updater->queue.stats = (struct UpdaterStats) {0};
+	return updater;
+}
+
+int queueUpdate(struct QueueUpdater * updater, struct AddrEvent const * event) {
+	struct EventQueue * queue = updater->queue;
+	size_t const tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	size_t const head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if (tail - head == QUEUE_SIZE) {
+		// Never block the monitor, it keeps the change pending and offers it again
+		if (!updater->full) fputs("Update queue full, holding changes\n", stderr);
+		updater->full = true;
+		return UPDATE_BUSY;
+	}
+	queue->events[tail & (QUEUE_SIZE - 1)] = *event;
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	updater->stats.issued++;
+	updater->stats.succeeded++;
+	updater->pushed = true;
+	updater->full = false;
+	return 0;
+}
+
+int prepareQueueUpdater(struct QueueUpdater * updater) {
+	atomic_store_explicit(&updater->queue->prepare, true, memory_order_relaxed);
+	updater->pushed = true;
+	return 0;
+}
+
+int flushQueueUpdater(struct QueueUpdater * updater) {
+	if (!updater->pushed) return 0;
+	updater->pushed = false;
+	return wake(updater->queue);
+}
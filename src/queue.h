@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ipaddr.h"
+#include "stats.h"
+
+// Must be a power of two. Changes are rare, this is only to ride out storms
+// while the updater thread is busy.
+#define QUEUE_SIZE 256
+
+// Single producer, single consumer ring of events between the monitor thread
+// and the updater thread. The eventfd wakes the consumer once per batch.
+struct EventQueue {
+	struct AddrEvent events[QUEUE_SIZE];
+	// Next to pop, only written by the consumer
+	_Alignas(64) atomic_size_t head;
+	// Next to push, only written by the producer
+	_Alignas(64) atomic_size_t tail;
+	// Set by the producer once it has stopped, with its result
+	atomic_bool closed;
+	atomic_int result;
+	// Set by the producer to have prepareUpdater called
+	atomic_bool prepare;
+	int event_fd;
+};
+
+// The producer side, handed to the monitor as its updater
+struct QueueUpdater {
+	struct EventQueue * queue;
+	// Pushed since the consumer was last woken
+	bool pushed;
+	// Turned an event away since the last one pushed, to report a full queue once
+	bool full;
+	struct UpdaterStats stats;
+};
+
+int createQueue(struct EventQueue * queue);
+void destroyQueue(struct EventQueue * queue);
+// Producer only. Tells the consumer nothing more is coming.
+int closeQueue(struct EventQueue * queue, int result);
+
+// UPDATE_BUSY when the queue is full, the monitor holds on to the change then
+int queueUpdate(struct QueueUpdater * updater, struct AddrEvent const * event);
+int flushQueueUpdater(struct QueueUpdater * updater);
+int prepareQueueUpdater(struct QueueUpdater * updater);
+
+#include "updater.h"
+
+Updater_t createQueueUpdater(struct EventQueue * queue);
+// Consumer only. Passes everything queued to updater, returns 1 once the
+// queue is closed and empty.
+int drainQueue(struct EventQueue * queue, Updater_t updater);
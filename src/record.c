@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "record.h"
+#include "timespec.h"
+#include "util.h"
+
+// Datagrams fed per wakeup, so updates get a look in during fast replays
+#define REPLAY_BATCH 64
+// Anything larger is taken as a corrupt recording
+#define MAX_DATAGRAM_LEN (1 << 20)
+
+FILE * openRecording(char const * path) {
+	FILE * recording = fopen(path, "ab");
+	if (recording == NULL) return NULL;
+
+	if (fseek(recording, 0, SEEK_END) != 0) goto cleanup;
+	if (ftell(recording) == 0) {
+		struct RecordingHeader header = {.version = RECORDING_VERSION};
+		memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+		if (fwrite(&header, sizeof(header), 1, recording) != 1) goto cleanup;
+	}
+	return recording;
+
+cleanup:
+	fclose(recording);
+	return NULL;
+}
+
+int recordDatagram(FILE * recording, unsigned int netns, char const * buf, size_t len) {
+	struct timespec now;
+	if (clock_gettime(CLOCK_REALTIME, &now) == -1) return -1;
+	uint64_t timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	uint32_t netns32 = netns;
+	uint32_t len32 = len;
+
+	if (fwrite(&timestamp, sizeof(timestamp), 1, recording) != 1
+	    || fwrite(&netns32, sizeof(netns32), 1, recording) != 1
+	    || fwrite(&len32, sizeof(len32), 1, recording) != 1
+	    || fwrite(buf, 1, len, recording) != len) return -1;
+	return 0;
+}
+
+struct Replay {
+	FILE * recording;
+	bool realtime;
+	Monitor_t monitor;
+	unsigned long long count;
+
+	// Next datagram to feed, if have_next
+	bool have_next;
+	uint64_t timestamp;
+	uint32_t netns;
+	char * buf;
+	size_t buf_len;
+	size_t len;
+
+	// Recording time of the first datagram, and when it was replayed
+	uint64_t first_timestamp;
+	struct timespec start;
+
+	int epoll_fd;
+	int timer_fd;
+	struct EpollData epoll_data;
+};
+
+static int readNext(Replay_t replay) {
+	uint32_t len;
+	if (fread(&replay->timestamp, sizeof(replay->timestamp), 1, replay->recording) != 1
+	    || fread(&replay->netns, sizeof(replay->netns), 1, replay->recording) != 1
+	    || fread(&len, sizeof(len), 1, replay->recording) != 1) {
+		replay->have_next = false;
+		return ferror(replay->recording) ? -1 : 0;
+	}
+	if (len > MAX_DATAGRAM_LEN) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (len > replay->buf_len) {
+		char * buf = realloc(replay->buf, len);
+		if (buf == NULL) return -1;
+		replay->buf = buf;
+		replay->buf_len = len;
+	}
+	if (fread(replay->buf, 1, len, replay->recording) != len) {
+		// Truncated, e.g. recorder killed mid-write
+		replay->have_next = false;
+		return ferror(replay->recording) ? -1 : 0;
+	}
+	replay->len = len;
+	replay->have_next = true;
+	return 0;
+}
+
+static struct timespec nextDue(Replay_t replay) {
+	// Recordings may be appended to across reboots, never go backwards
+	uint64_t offset = replay->timestamp > replay->first_timestamp ? replay->timestamp - replay->first_timestamp : 0;
+	return timespecAddNs(replay->start, offset);
+}
+
+static int armReplay(Replay_t replay) {
+	struct itimerspec timer = {0};
+	if (replay->realtime) {
+		timer.it_value = nextDue(replay);
+		return timerfd_settime(replay->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+	} else {
+		// Straight away, but after anything else that is ready
+		timer.it_value.tv_nsec = 1;
+		return timerfd_settime(replay->timer_fd, 0, &timer, NULL);
+	}
+}
+
+Replay_t createReplay(char const * path, bool realtime, int epoll_fd, Monitor_t monitor) {
+	Replay_t replay = malloc(sizeof(*replay));
+	if (replay == NULL) return NULL;
+	replay->realtime = realtime;
+	replay->monitor = monitor;
+	replay->count = 0;
+	replay->buf = NULL;
+	replay->buf_len = 0;
+	replay->epoll_fd = -1;
+	replay->timer_fd = -1;
+
+	replay->recording = fopen(path, "rb");
+	if (replay->recording == NULL) goto cleanup;
+
+	struct RecordingHeader header;
+	if (fread(&header, sizeof(header), 1, replay->recording) != 1
+	    || memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0
+	    || header.version != RECORDING_VERSION) {
+		errno = EINVAL;
+		goto cleanup;
+	}
+	if (readNext(replay) != 0) goto cleanup;
+	replay->first_timestamp = replay->timestamp;
+	if (clock_gettime(CLOCK_MONOTONIC, &replay->start) == -1) goto cleanup;
+
+	replay->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (replay->timer_fd == -1) goto cleanup;
+	struct EpollData * data = &replay->epoll_data;
+	data->tag = EPOLL_REPLAY;
+	data->fd = replay->timer_fd;
+	data->replay = replay;
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data = { .ptr = data },
+	};
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, replay->timer_fd, &event) == -1) goto cleanup;
+	replay->epoll_fd = epoll_fd;
+
+	if (armReplay(replay) != 0) goto cleanup;
+	return replay;
+
+cleanup:
+	destroyReplay(replay);
+	return NULL;
+}
+
+int processReplay(Replay_t replay, int fd, __attribute__((unused)) int32_t events) {
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return -1;
+
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+	for (size_t i = 0; i < REPLAY_BATCH && replay->have_next; i++) {
+		if (replay->realtime && timespecBefore(now, nextDue(replay))) break;
+		if (feedMessage(replay->monitor, replay->netns, replay->buf, replay->len) != 0) return -1;
+		replay->count++;
+		if (readNext(replay) != 0) return -1;
+	}
+	if (finishBatch(replay->monitor) != 0) return -1;
+
+	if (!replay->have_next) {
+		// Nothing more is coming, don't wait for it to settle
+		if (flushMonitor(replay->monitor) != 0) return -1;
+		return 1;
+	}
+	return armReplay(replay);
+}
+
+unsigned long long replayCount(Replay_t replay) {
+	return replay->count;
+}
+
+void destroyReplay(Replay_t replay) {
+	if (replay->epoll_fd >= 0) {
+		epoll_ctl(replay->epoll_fd, EPOLL_CTL_DEL, replay->timer_fd, NULL);
+	}
+	if (replay->timer_fd >= 0) {
+		close(replay->timer_fd);
+	}
+	if (replay->recording != NULL) {
+		fclose(replay->recording);
+	}
+	free(replay->buf);
+	free(replay);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "monitor.h"
+
+// A recording is a RecordingHeader followed by records, each a CLOCK_REALTIME
+// timestamp in ns (uint64_t), the monitor's namespace number (uint32_t), a
+// length (uint32_t) and that many bytes of netlink datagram. Everything is in
+// host byte order.
+#define RECORDING_MAGIC "DYNR"
+#define RECORDING_VERSION 2
+
+struct RecordingHeader {
+	char magic[4];
+	uint32_t version;
+};
+
+// Opens path for appending, writing the header if it is new
+FILE * openRecording(char const * path);
+int recordDatagram(FILE * recording, unsigned int netns, char const * buf, size_t len);
+
+typedef struct Replay * Replay_t;
+// Feeds a recording through monitor, either as fast as possible or with the
+// original spacing between datagrams, in place of its netlink socket
+Replay_t createReplay(char const * path, bool realtime, int epoll_fd, Monitor_t monitor);
+// Returns 1 once the whole recording has been replayed
+int processReplay(Replay_t replay, int fd, int32_t events);
+unsigned long long replayCount(Replay_t replay);
+void destroyReplay(Replay_t replay);
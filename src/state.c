@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include "state.h"
+#include "strlcpy.h"
+
+uint64_t stateKey(char const * str) {
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (; *str != '\0'; str++) {
+		hash ^= (unsigned char) *str;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static struct StateEntry * findEntry(struct State const * state, uint64_t target, char const * iface,
+                                     char const * netns, unsigned char af) {
+	if (netns == NULL) netns = "";
+	for (size_t i = 0; i < state->n_entries; i++) {
+		struct StateEntry * entry = &state->entries[i];
+		if (entry->target == target && entry->addr.af == af && strcmp(entry->iface, iface) == 0
+		    && strcmp(entry->netns, netns) == 0) return entry;
+	}
+	return NULL;
+}
+
+int loadState(struct State * state, char const * path) {
+	state->path = path;
+	state->n_entries = 0;
+	state->entries = calloc(STATE_MAX_ENTRIES, sizeof(*state->entries));
+	if (state->entries == NULL) return -1;
+	if (path == NULL) return 0;
+
+	FILE * file = fopen(path, "r");
+	if (file == NULL) return errno == ENOENT ? 0 : -1;
+
+	char line[512];
+	while (fgets(line, sizeof(line), file) != NULL && state->n_entries < STATE_MAX_ENTRIES) {
+		struct StateEntry * entry = &state->entries[state->n_entries];
+		// <interface>[@<netns>]
+		char iface[IF_NAMESIZE + NAME_MAX + 2];
+		char addr[INET6_ADDRSTRLEN + 1];
+		// Skip anything malformed, worst case is one redundant update
+		if (sscanf(line, "%16" SCNx64 " %271s %46s", &entry->target, iface, addr) != 3) continue;
+		char * netns = strchr(iface, '@');
+		if (netns != NULL) *netns++ = '\0';
+		if (strlen(iface) >= IF_NAMESIZE || (netns != NULL && (*netns == '\0' || strlen(netns) > NAME_MAX))) continue;
+		strlcpy(entry->iface, iface, sizeof(entry->iface));
+		strlcpy(entry->netns, netns != NULL ? netns : "", sizeof(entry->netns));
+		if (inet_pton(AF_INET, addr, &entry->addr.ipv4) == 1) {
+			entry->addr.af = AF_INET;
+		} else if (inet_pton(AF_INET6, addr, &entry->addr.ipv6) == 1) {
+			entry->addr.af = AF_INET6;
+		} else {
+			continue;
+		}
+		if (findEntry(state, entry->target, entry->iface, entry->netns, entry->addr.af) == NULL) state->n_entries++;
+	}
+	int const result = ferror(file) ? -1 : 0;
+	fclose(file);
+	return result;
+}
+
+bool statePublished(struct State const * state, uint64_t target, char const * iface, char const * netns,
+                    struct IPAddr const * addr) {
+	struct StateEntry const * entry = findEntry(state, target, iface, netns, addr->af);
+	return entry != NULL && addrEqual(entry->addr, *addr);
+}
+
+static int saveState(struct State const * state) {
+	char tmp_path[PATH_MAX];
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state->path) >= (int) sizeof(tmp_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) return -1;
+	FILE * file = fdopen(fd, "w");
+	if (file == NULL) {
+		close(fd);
+		goto cleanup;
+	}
+
+	for (size_t i = 0; i < state->n_entries; i++) {
+		struct StateEntry const * entry = &state->entries[i];
+		char addr[INET6_ADDRSTRLEN];
+		formatAddr(&entry->addr, addr);
+		if (fprintf(file, "%016" PRIx64 " %s%s%s %s\n", entry->target, entry->iface, *entry->netns != '\0' ? "@" : "",
+		            entry->netns, addr) < 0) goto cleanup_file;
+	}
+	if (fflush(file) != 0 || fsync(fd) != 0) goto cleanup_file;
+	if (fclose(file) != 0) goto cleanup;
+	if (rename(tmp_path, state->path) != 0) goto cleanup;
+	return 0;
+
+cleanup_file:
+	fclose(file);
+cleanup:
+	unlink(tmp_path);
+	return -1;
+}
+
+int storeState(struct State * state, uint64_t target, char const * iface, char const * netns,
+               struct IPAddr const * addr) {
+	struct StateEntry * entry = findEntry(state, target, iface, netns, addr->af);
+	if (entry == NULL) {
+		// Entries for interfaces and targets that are gone are never dropped,
+		// so give up on keeping state rather than grow without bound
+		if (state->n_entries == STATE_MAX_ENTRIES) return 0;
+		entry = &state->entries[state->n_entries++];
+		entry->target = target;
+		strlcpy(entry->iface, iface, sizeof(entry->iface));
+		strlcpy(entry->netns, netns != NULL ? netns : "", sizeof(entry->netns));
+	} else if (addrEqual(entry->addr, *addr)) {
+		return 0;
+	}
+	entry->addr = *addr;
+	return state->path == NULL ? 0 : saveState(state);
+}
+
+void destroyState(struct State * state) {
+	free(state->entries);
+	state->entries = NULL;
+	state->n_entries = 0;
+}
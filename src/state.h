@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <limits.h>
+#include <net/if.h>
+
+#include "ipaddr.h"
+
+// The last address successfully published to each target, per interface and
+// family, so a restart doesn't republish unchanged addresses. Stored as text
+// lines of "<target key> <interface>[@<netns>] <address>".
+#define STATE_MAX_ENTRIES 1024
+
+struct StateEntry {
+	uint64_t target;
+	char iface[IF_NAMESIZE];
+	// Empty for our own namespace
+	char netns[NAME_MAX + 1];
+	struct IPAddr addr;
+};
+
+struct State {
+	// NULL if not persisted
+	char const * path;
+	struct StateEntry * entries;
+	size_t n_entries;
+};
+
+// Identifies a target across restarts, from its URL template or similar
+uint64_t stateKey(char const * str);
+// A missing file is an empty state
+int loadState(struct State * state, char const * path);
+// netns is the interface's namespace, NULL for our own
+bool statePublished(struct State const * state, uint64_t target, char const * iface, char const * netns,
+                    struct IPAddr const * addr);
+// Replaces the file atomically, so a crash leaves either the old or the new state
+int storeState(struct State * state, uint64_t target, char const * iface, char const * netns,
+               struct IPAddr const * addr);
+void destroyState(struct State * state);
@@ -0,0 +1,15 @@
+#include "stats.h"
+
+static unsigned int const bucket_bounds_ms[N_LATENCY_BUCKETS] = {LATENCY_BUCKETS_MS};
+
+void observeLatency(struct UpdaterStats * stats, struct timespec received) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double seconds = (now.tv_sec - received.tv_sec) + (now.tv_nsec - received.tv_nsec) / 1e9;
+
+	size_t bucket = 0;
+	while (bucket < N_LATENCY_BUCKETS && seconds * 1000 > bucket_bounds_ms[bucket]) bucket++;
+	stats->latency_buckets[bucket]++;
+	stats->latency_count++;
+	stats->latency_sum += seconds;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <time.h>
+
+// Upper bounds of the update latency histogram buckets, in milliseconds
+#define LATENCY_BUCKETS_MS 1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000
+#define N_LATENCY_BUCKETS 14
+
+// Counted by each updater as it goes, read by the metrics endpoint
+struct UpdaterStats {
+	// Updates started, one per target, retries not included
+	unsigned long long issued;
+	unsigned long long succeeded;
+	// Given up on, after any retries
+	unsigned long long failed;
+	unsigned long long retried;
+	// Held back by a rate limit
+	unsigned long long throttled;
+
+	// Time from receiving the netlink message to a successful update.
+	// Cumulative as Prometheus wants it is left to the reader.
+	unsigned long long latency_buckets[N_LATENCY_BUCKETS + 1];
+	unsigned long long latency_count;
+	double latency_sum;
+};
+
+// received is CLOCK_MONOTONIC
+void observeLatency(struct UpdaterStats * stats, struct timespec received);
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "updater.h"
+#include "dns.h"
+#include "timespec.h"
+#include "util.h"
+
+#define MAX_CLIENTS 4
+#define TEST_TIMEOUT_MS 5000
+
+#define RCODE_NOERROR 0
+#define RCODE_SERVFAIL 2
+
+// An authoritative server on the same epoll, over UDP and TCP on one port. It ignores the first
+// silent updates, answers the next servfails with SERVFAIL and every other with NOERROR. With
+// truncate, UDP replies only say to retry over TCP, and do so twice.
+struct Client {
+	int fd;
+	unsigned char buf[DNS_MAX_MESSAGE + 2];
+	size_t len;
+};
+
+struct Server {
+	int udp_fd;
+	int tcp_fd;
+	struct Client clients[MAX_CLIENTS];
+	unsigned int silent;
+	unsigned int servfails;
+	bool truncate;
+	unsigned int udp_queries;
+	unsigned int tcp_queries;
+	unsigned int connections;
+};
+
+static int bindServer(struct Server * server, unsigned short * port) {
+	// UDP takes any free port, TCP then has to get the same one, which is rarely taken already
+	for (int attempt = 0; attempt < 8; attempt++) {
+		struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+		socklen_t addr_len = sizeof(addr);
+		server->udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		server->tcp_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (server->udp_fd == -1 || server->tcp_fd == -1
+		    || bind(server->udp_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+		    || getsockname(server->udp_fd, (struct sockaddr *) &addr, &addr_len) == -1) return -1;
+		if (bind(server->tcp_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+			*port = ntohs(addr.sin_port);
+			return listen(server->tcp_fd, MAX_CLIENTS);
+		}
+		if (errno != EADDRINUSE) return -1;
+		close(server->udp_fd);
+		close(server->tcp_fd);
+	}
+	return -1;
+}
+
+static int startServer(struct Server * server, int epoll_fd, unsigned short * port) {
+	for (size_t i = 0; i < MAX_CLIENTS; i++) server->clients[i].fd = -1;
+	if (bindServer(server, port) != 0) return -1;
+	struct epoll_event udp_event = {.events = EPOLLIN, .data = {.ptr = &server->udp_fd}};
+	struct epoll_event tcp_event = {.events = EPOLLIN, .data = {.ptr = &server->tcp_fd}};
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server->udp_fd, &udp_event) == -1) return -1;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server->tcp_fd, &tcp_event);
+}
+
+// Turns query into its reply, without a body. Returns false to ignore it.
+static bool answer(struct Server * server, unsigned char * query, size_t len, bool tcp) {
+	if (len < DNS_HEADER_LEN) return false;
+	if (server->silent > 0) {
+		server->silent--;
+		return false;
+	}
+	unsigned int rcode = RCODE_NOERROR;
+	if (server->servfails > 0) {
+		server->servfails--;
+		rcode = RCODE_SERVFAIL;
+	}
+	// QR and the query's opcode, then TC if asked to and the rcode
+	query[2] = 0x80 | (query[2] & 0x78) | (server->truncate && !tcp ? 0x02 : 0);
+	query[3] = rcode;
+	memset(query + 4, 0, DNS_HEADER_LEN - 4);
+	return true;
+}
+
+static int serveUdp(struct Server * server) {
+	unsigned char msg[DNS_MAX_MESSAGE];
+	struct sockaddr_storage peer;
+	socklen_t peer_len = sizeof(peer);
+	ssize_t len = recvfrom(server->udp_fd, msg, sizeof(msg), 0, (struct sockaddr *) &peer, &peer_len);
+	if (len == -1) return errno == EAGAIN ? 0 : -1;
+	server->udp_queries++;
+	if (!answer(server, msg, len, false)) return 0;
+	for (int i = 0; i < (server->truncate ? 2 : 1); i++) {
+		if (sendto(server->udp_fd, msg, DNS_HEADER_LEN, 0, (struct sockaddr *) &peer, peer_len) == -1) return -1;
+	}
+	return 0;
+}
+
+// Takes every connection waiting, so none go uncounted
+static int acceptClients(struct Server * server, int epoll_fd) {
+	for (;;) {
+		int fd = accept4(server->tcp_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) return errno == EAGAIN ? 0 : -1;
+		server->connections++;
+		struct Client * client = NULL;
+		for (size_t i = 0; i < MAX_CLIENTS && client == NULL; i++) {
+			if (server->clients[i].fd < 0) client = &server->clients[i];
+		}
+		if (client == NULL) {
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		client->len = 0;
+		struct epoll_event event = {.events = EPOLLIN, .data = {.ptr = client}};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) return -1;
+	}
+}
+
+static int serveClient(struct Server * server, struct Client * client) {
+	ssize_t len = recv(client->fd, client->buf + client->len, sizeof(client->buf) - client->len, 0);
+	if (len == -1 && errno == EAGAIN) return 0;
+	if (len <= 0) {
+		close(client->fd);
+		client->fd = -1;
+		return 0;
+	}
+	client->len += len;
+	// Length prefix, then the query
+	if (client->len < 2 || client->len < 2 + (size_t) get16(client->buf)) return 0;
+	server->tcp_queries++;
+	size_t const query_len = get16(client->buf);
+	client->len = 0;
+	if (!answer(server, client->buf + 2, query_len, true)) return 0;
+	put16(client->buf, DNS_HEADER_LEN);
+	return send(client->fd, client->buf, 2 + DNS_HEADER_LEN, MSG_NOSIGNAL) == -1 ? -1 : 0;
+}
+
+// Serves the updater and the server until the updater is done, or gives up
+static int runUntilIdle(int epoll_fd, Updater_t updater, struct Server * server) {
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		struct epoll_event events[16];
+		int nevents = epoll_wait(epoll_fd, events, NELEMS(events), 100);
+		if (nevents < 0 && errno != EINTR) return -1;
+		for (int i = 0; i < nevents; i++) {
+			void * ptr = events[i].data.ptr;
+			int result;
+			if (ptr == &server->udp_fd) {
+				result = serveUdp(server);
+			} else if (ptr == &server->tcp_fd) {
+				result = acceptClients(server, epoll_fd);
+			} else if (ptr >= (void *) server->clients && ptr < (void *) (server->clients + MAX_CLIENTS)) {
+				result = serveClient(server, ptr);
+			} else {
+				struct EpollData * data = ptr;
+				result = handleMessage(updater, data->fd, events[i].events);
+			}
+			if (result != 0) return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespecBefore(timespecAddMs(start, TEST_TIMEOUT_MS), now)) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	} while (!updaterIdle(updater));
+	return 0;
+}
+
+static void stopServer(struct Server * server) {
+	for (size_t i = 0; i < MAX_CLIENTS; i++) {
+		if (server->clients[i].fd >= 0) close(server->clients[i].fd);
+	}
+	close(server->udp_fd);
+	close(server->tcp_fd);
+}
+
+// Sends one update to server, configured by the caller, and runs it to the end
+static int runUpdate(int epoll_fd, struct Server * server, unsigned int max_retries,
+                     struct UpdaterStats * stats) {
+	unsigned short port;
+	if (startServer(server, epoll_fd, &port) != 0) {
+		perror("Couldn't start DNS server");
+		return -1;
+	}
+	char address[32];
+	snprintf(address, sizeof(address), "127.0.0.1:%hu", port);
+	Updater_t updater = createDnsUpdater(epoll_fd, (struct DnsUpdaterOptions) {
+		.server = address,
+		.zone = "example.test",
+		.hostname = "host",
+		.ttl = 60,
+		.max_retries = max_retries,
+		.retry_base_ms = 10,
+		.retry_max_ms = 10,
+	});
+	if (updater == NULL) {
+		perror("Couldn't create updater");
+		stopServer(server);
+		return -1;
+	}
+
+	struct AddrEvent event = {.iface = "eth0", .ifindex = 2, .addr = {.af = AF_INET, .prefixlen = 24}};
+	inet_pton(AF_INET, "192.0.2.1", &event.addr.ipv4);
+	event.ipv4 = event.addr;
+	clock_gettime(CLOCK_MONOTONIC, &event.received);
+	int result = update(updater, &event);
+	if (result == 0) result = runUntilIdle(epoll_fd, updater, server);
+	// Connections the updater made but no longer waits on
+	if (result == 0) result = acceptClients(server, epoll_fd);
+	if (result != 0) perror("Error running updater");
+	*stats = *updaterStats(updater);
+
+	destroyUpdater(updater);
+	stopServer(server);
+	return result;
+}
+
+static int testSuccess(int epoll_fd) {
+	struct Server server = {0};
+	struct UpdaterStats stats;
+	if (runUpdate(epoll_fd, &server, 2, &stats) != 0) return -1;
+	if (server.udp_queries != 1 || stats.succeeded != 1 || stats.retried != 0) {
+		fprintf(stderr, "Expected an answered update, got %u queries\n", server.udp_queries);
+		return -1;
+	}
+	return 0;
+}
+
+static int testServfail(int epoll_fd) {
+	struct Server server = {.servfails = 1};
+	struct UpdaterStats stats;
+	if (runUpdate(epoll_fd, &server, 2, &stats) != 0) return -1;
+	if (server.udp_queries != 2 || stats.succeeded != 1 || stats.retried != 1) {
+		fprintf(stderr, "Expected an update and its retry, got %u queries\n", server.udp_queries);
+		return -1;
+	}
+	return 0;
+}
+
+static int testTimeout(int epoll_fd) {
+	struct Server server = {.silent = 1};
+	struct UpdaterStats stats;
+	if (runUpdate(epoll_fd, &server, 2, &stats) != 0) return -1;
+	if (server.udp_queries != 2 || stats.succeeded != 1 || stats.retried != 1) {
+		fprintf(stderr, "Expected an update and its retry, got %u queries\n", server.udp_queries);
+		return -1;
+	}
+	return 0;
+}
+
+static int testGiveUp(int epoll_fd) {
+	struct Server server = {.silent = 100};
+	struct UpdaterStats stats;
+	if (runUpdate(epoll_fd, &server, 2, &stats) != 0) return -1;
+	if (server.udp_queries != 3 || stats.failed != 1 || stats.retried != 2) {
+		fprintf(stderr, "Expected an update and 2 retries, got %u queries\n", server.udp_queries);
+		return -1;
+	}
+	return 0;
+}
+
+// Each truncated reply comes twice, and still only one connection is made
+static int testTruncated(int epoll_fd) {
+	struct Server server = {.truncate = true};
+	struct UpdaterStats stats;
+	if (runUpdate(epoll_fd, &server, 2, &stats) != 0) return -1;
+	if (server.udp_queries != 1 || server.connections != 1 || server.tcp_queries != 1 || stats.succeeded != 1) {
+		fprintf(stderr, "Expected a query over each, got %u over UDP and %u over %u TCP connections\n",
+		        server.udp_queries, server.tcp_queries, server.connections);
+		return -1;
+	}
+	return 0;
+}
+
+int main(void) {
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) return EXIT_FAILURE;
+
+	if (testSuccess(epoll_fd) != 0) {
+		fputs("FAIL: answered update\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testServfail(epoll_fd) != 0) {
+		fputs("FAIL: retry after SERVFAIL\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testTimeout(epoll_fd) != 0) {
+		fputs("FAIL: retry after timeout\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testGiveUp(epoll_fd) != 0) {
+		fputs("FAIL: giving up after retries\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testTruncated(epoll_fd) != 0) {
+		fputs("FAIL: fallback to TCP\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	close(epoll_fd);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tsig.h"
+
+// An update replacing host.example.com's A record with 192.0.2.1, and the server's reply, signed
+// with hmac-sha256 key testkey at 1700000000 by an independent implementation (dnspython)
+#define KEY "hmac-sha256:testkey:c2VjcmV0c2VjcmV0c2VjcmV0c2VjcmV0"
+#define TIME_SIGNED 1700000000
+
+static unsigned char const request[] = {
+	0x12, 0x34, 0x28, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00,
+	0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+	0x00, 0x00, 0x06, 0x00, 0x01, 0x04, 0x68, 0x6f, 0x73, 0x74, 0xc0, 0x0c,
+	0x00, 0x01, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x1d,
+	0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0xc0, 0x00,
+	0x02, 0x01,
+};
+
+static unsigned char const signed_request[] = {
+	0x12, 0x34, 0x28, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x01,
+	0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+	0x00, 0x00, 0x06, 0x00, 0x01, 0x04, 0x68, 0x6f, 0x73, 0x74, 0xc0, 0x0c,
+	0x00, 0x01, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0, 0x1d,
+	0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0xc0, 0x00,
+	0x02, 0x01, 0x07, 0x74, 0x65, 0x73, 0x74, 0x6b, 0x65, 0x79, 0x00, 0x00,
+	0xfa, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3d, 0x0b, 0x68, 0x6d,
+	0x61, 0x63, 0x2d, 0x73, 0x68, 0x61, 0x32, 0x35, 0x36, 0x00, 0x00, 0x00,
+	0x65, 0x53, 0xf1, 0x00, 0x01, 0x2c, 0x00, 0x20, 0x67, 0x63, 0xde, 0xc4,
+	0x85, 0x75, 0x0f, 0x4c, 0x54, 0x55, 0x03, 0x80, 0xe1, 0xb5, 0xc1, 0x6d,
+	0xfa, 0xfe, 0xd4, 0x07, 0x69, 0x09, 0x49, 0x87, 0xee, 0xec, 0x0c, 0x01,
+	0x3d, 0xee, 0xf0, 0xda, 0x12, 0x34, 0x00, 0x00, 0x00, 0x00,
+};
+
+static unsigned char const reply[] = {
+	0x12, 0x34, 0xa8, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+	0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d,
+	0x00, 0x00, 0x06, 0x00, 0x01, 0x07, 0x74, 0x65, 0x73, 0x74, 0x6b, 0x65,
+	0x79, 0x00, 0x00, 0xfa, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3d,
+	0x0b, 0x68, 0x6d, 0x61, 0x63, 0x2d, 0x73, 0x68, 0x61, 0x32, 0x35, 0x36,
+	0x00, 0x00, 0x00, 0x65, 0x53, 0xf1, 0x00, 0x01, 0x2c, 0x00, 0x20, 0x09,
+	0xc6, 0x25, 0x54, 0xcc, 0x73, 0x64, 0xa0, 0xf2, 0x99, 0xab, 0xe5, 0x62,
+	0xb5, 0x57, 0x9c, 0x6d, 0x74, 0xce, 0x37, 0x37, 0xee, 0x9e, 0x07, 0xd6,
+	0xa3, 0xc0, 0xa3, 0xb9, 0x40, 0x6e, 0x09, 0x12, 0x34, 0x00, 0x00, 0x00,
+	0x00,
+};
+
+static int testSign(struct DnsKey const * key, unsigned char * mac, unsigned int * mac_len) {
+	unsigned char message[sizeof(request) + TSIG_MAX_LEN];
+	memcpy(message, request, sizeof(request));
+	size_t len = tsigSign(key, message, sizeof(request), TIME_SIGNED, mac, mac_len);
+	if (len != sizeof(signed_request) || memcmp(message, signed_request, len) != 0) return -1;
+	return 0;
+}
+
+static int testVerify(struct DnsKey const * key, unsigned char const * mac, unsigned int mac_len) {
+	uint16_t tsig_error = 0;
+	if (!tsigVerify(key, mac, mac_len, reply, sizeof(reply), TIME_SIGNED + 10, &tsig_error)
+	    || tsig_error != 0) return -1;
+
+	// Any change to what is signed fails
+	unsigned char tampered[sizeof(reply)];
+	memcpy(tampered, reply, sizeof(reply));
+	tampered[3] ^= 1;
+	if (tsigVerify(key, mac, mac_len, tampered, sizeof(tampered), TIME_SIGNED, &tsig_error)) return -1;
+	// As does a reply to another request
+	unsigned char other_mac[EVP_MAX_MD_SIZE];
+	memcpy(other_mac, mac, mac_len);
+	other_mac[0] ^= 1;
+	if (tsigVerify(key, other_mac, mac_len, reply, sizeof(reply), TIME_SIGNED, &tsig_error)) return -1;
+
+	// Signed too long ago
+	tsig_error = 0;
+	if (tsigVerify(key, mac, mac_len, reply, sizeof(reply), TIME_SIGNED + TSIG_FUDGE + 1, &tsig_error)
+	    || tsig_error != 18) return -1;
+	return 0;
+}
+
+int main(void) {
+	struct DnsKey key;
+	if (parseTsigKey(KEY, &key) != 0) {
+		fputs("FAIL: parsing the key\n", stderr);
+		return EXIT_FAILURE;
+	}
+	unsigned char mac[EVP_MAX_MD_SIZE];
+	unsigned int mac_len;
+	if (testSign(&key, mac, &mac_len) != 0) {
+		fputs("FAIL: signing the request\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testVerify(&key, mac, mac_len) != 0) {
+		fputs("FAIL: verifying the reply\n", stderr);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
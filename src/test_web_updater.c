@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "updater.h"
+#include "timespec.h"
+#include "util.h"
+
+#define MAX_CLIENTS 8
+#define MAX_RECORDS 4
+#define MAX_PATHS 16
+#define TEST_TIMEOUT_MS 5000
+
+// A minimal HTTP server on the same epoll, answering the first failures requests with a 503 and
+// every other with an empty 200, and noting their paths
+struct Client {
+	int fd;
+	char buf[4096];
+	size_t len;
+};
+
+struct Server {
+	int fd;
+	struct Client clients[MAX_CLIENTS];
+	char paths[MAX_PATHS][256];
+	size_t n_paths;
+	unsigned int failures;
+	// Always readable when not -1, keeping the loop from ever waiting out a timeout
+	int busy;
+	// Served alongside, if not NULL
+	struct DnsServer * dns;
+};
+
+// An authoritative DNS server on the same epoll, answering A queries from its records. Names it
+// has no record of go unanswered, so that checks of them time out.
+struct DnsRecord {
+	char const * name;
+	char const * addr;
+};
+
+struct DnsServer {
+	int fd;
+	struct DnsRecord records[MAX_RECORDS];
+	size_t n_records;
+	unsigned int queries;
+};
+
+static int startServer(struct Server * server, int epoll_fd, unsigned short * port) {
+	memset(server, 0, sizeof(*server));
+	for (size_t i = 0; i < MAX_CLIENTS; i++) server->clients[i].fd = -1;
+	server->busy = -1;
+	struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+	socklen_t addr_len = sizeof(addr);
+	server->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (server->fd == -1 || bind(server->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+	    || listen(server->fd, MAX_CLIENTS) == -1
+	    || getsockname(server->fd, (struct sockaddr *) &addr, &addr_len) == -1) return -1;
+	*port = ntohs(addr.sin_port);
+	struct epoll_event event = {.events = EPOLLIN, .data = {.ptr = server}};
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server->fd, &event);
+}
+
+static int acceptClient(struct Server * server, int epoll_fd) {
+	int fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1) return errno == EAGAIN ? 0 : -1;
+	for (size_t i = 0; i < MAX_CLIENTS; i++) {
+		struct Client * client = &server->clients[i];
+		if (client->fd >= 0) continue;
+		client->fd = fd;
+		client->len = 0;
+		struct epoll_event event = {.events = EPOLLIN, .data = {.ptr = client}};
+		return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+	}
+	close(fd);
+	return 0;
+}
+
+static int serveClient(struct Server * server, struct Client * client) {
+	ssize_t len = recv(client->fd, client->buf + client->len, sizeof(client->buf) - client->len - 1, 0);
+	if (len == -1 && errno == EAGAIN) return 0;
+	if (len <= 0) {
+		close(client->fd);
+		client->fd = -1;
+		return 0;
+	}
+	client->len += len;
+	client->buf[client->len] = '\0';
+
+	// Every complete request on the connection, kept alive between them
+	char * end;
+	while ((end = strstr(client->buf, "\r\n\r\n")) != NULL) {
+		char method[16];
+		if (server->n_paths < MAX_PATHS
+		    && sscanf(client->buf, "%15s %255s", method, server->paths[server->n_paths]) == 2) {
+			server->n_paths++;
+		}
+		static char const ok[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+		static char const unavailable[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+		char const * reply = ok;
+		if (server->failures > 0) {
+			server->failures--;
+			reply = unavailable;
+		}
+		if (send(client->fd, reply, strlen(reply), MSG_NOSIGNAL) == -1) return -1;
+		end += 4;
+		client->len -= end - client->buf;
+		memmove(client->buf, end, client->len + 1);
+	}
+	return 0;
+}
+
+static bool requested(struct Server const * server, char const * path) {
+	for (size_t i = 0; i < server->n_paths; i++) {
+		if (strcmp(server->paths[i], path) == 0) return true;
+	}
+	return false;
+}
+
+static int startDnsServer(struct DnsServer * dns, int epoll_fd, unsigned short * port) {
+	struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+	socklen_t addr_len = sizeof(addr);
+	dns->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	dns->queries = 0;
+	if (dns->fd == -1 || bind(dns->fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+	    || getsockname(dns->fd, (struct sockaddr *) &addr, &addr_len) == -1) return -1;
+	*port = ntohs(addr.sin_port);
+	struct epoll_event event = {.events = EPOLLIN, .data = {.ptr = dns}};
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dns->fd, &event);
+}
+
+static int serveDns(struct DnsServer * dns) {
+	unsigned char msg[512];
+	struct sockaddr_storage peer;
+	socklen_t peer_len = sizeof(peer);
+	ssize_t len = recvfrom(dns->fd, msg, sizeof(msg), 0, (struct sockaddr *) &peer, &peer_len);
+	if (len == -1) return errno == EAGAIN ? 0 : -1;
+	dns->queries++;
+
+	// The question's name, dotted
+	char name[256] = "";
+	size_t pos = 12, name_len = 0;
+	while (pos < (size_t) len && msg[pos] != 0 && name_len + msg[pos] + 1 < sizeof(name)) {
+		if (name_len > 0) name[name_len++] = '.';
+		memcpy(name + name_len, msg + pos + 1, msg[pos]);
+		name_len += msg[pos];
+		pos += msg[pos] + 1;
+	}
+	name[name_len] = '\0';
+	size_t const question_end = pos + 5;
+	if (question_end > (size_t) len) return 0;
+	bool const type_a = msg[pos + 1] == 0 && msg[pos + 2] == 1;
+
+	for (size_t i = 0; i < dns->n_records; i++) {
+		if (strcmp(dns->records[i].name, name) != 0) continue;
+		// Authoritative, and the record if A was asked for
+		msg[2] = 0x84;
+		msg[3] = 0;
+		msg[7] = type_a;
+		size_t reply_len = question_end;
+		if (type_a) {
+			unsigned char const answer[] = {0xC0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4};
+			memcpy(msg + reply_len, answer, sizeof(answer));
+			reply_len += sizeof(answer);
+			inet_pton(AF_INET, dns->records[i].addr, msg + reply_len);
+			reply_len += 4;
+		}
+		if (sendto(dns->fd, msg, reply_len, 0, (struct sockaddr *) &peer, peer_len) == -1) return -1;
+	}
+	return 0;
+}
+
+// Serves the updater and the server until the updater is done, or gives up
+static int runUntilIdle(int epoll_fd, struct Deadline const * deadline, Updater_t updater, struct Server * server) {
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long timeout = deadline->set ? timespecUntilMs(now, deadline->at) : 100;
+		struct epoll_event events[16];
+		int nevents = epoll_wait(epoll_fd, events, NELEMS(events), timeout < 100 ? timeout : 100);
+		if (nevents < 0 && errno != EINTR) return -1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (deadline->set && !timespecBefore(now, deadline->at) && handleTimeout(updater) != 0) return -1;
+		for (int i = 0; i < nevents; i++) {
+			void * ptr = events[i].data.ptr;
+			int result;
+			if (ptr == &server->busy) {
+				result = 0;
+			} else if (server->dns != NULL && ptr == server->dns) {
+				result = serveDns(server->dns);
+			} else if (ptr == server) {
+				result = acceptClient(server, epoll_fd);
+			} else if (ptr >= (void *) server->clients && ptr < (void *) (server->clients + MAX_CLIENTS)) {
+				result = serveClient(server, ptr);
+			} else {
+				struct EpollData * data = ptr;
+				result = handleMessage(updater, data->fd, events[i].events);
+			}
+			if (result != 0) return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespecBefore(timespecAddMs(start, TEST_TIMEOUT_MS), now)) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	} while (!updaterIdle(updater));
+	return 0;
+}
+
+static void stopServer(struct Server * server) {
+	for (size_t i = 0; i < MAX_CLIENTS; i++) {
+		if (server->clients[i].fd >= 0) close(server->clients[i].fd);
+	}
+	if (server->busy >= 0) close(server->busy);
+	if (server->dns != NULL) close(server->dns->fd);
+	close(server->fd);
+}
+
+static struct AddrEvent ipv4Event(char const * iface, unsigned int ifindex, char const * addr) {
+	struct AddrEvent event = {.iface = iface, .ifindex = ifindex, .addr = {.af = AF_INET, .prefixlen = 24}};
+	inet_pton(AF_INET, addr, &event.addr.ipv4);
+	event.ipv4 = event.addr;
+	clock_gettime(CLOCK_MONOTONIC, &event.received);
+	return event;
+}
+
+// Changes of two interfaces in one batch both reach a URL they share
+static int testInterfaces(int epoll_fd) {
+	struct Server server;
+	unsigned short port;
+	if (startServer(&server, epoll_fd, &port) != 0) {
+		perror("Couldn't start HTTP server");
+		return -1;
+	}
+	char url[128];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%hu/update?iface=<iface>&ip=<ipaddr>", port);
+	char const * const urls[] = {url};
+	struct Deadline deadline = {.set = false};
+	Updater_t updater = createWebUpdater(urls, NULL, NELEMS(urls), epoll_fd, &deadline, (struct WebUpdaterOptions) {
+		.hostname = "test",
+		.rate_burst = 2,
+	});
+	if (updater == NULL) {
+		perror("Couldn't create updater");
+		return -1;
+	}
+
+	struct AddrEvent const events[] = {
+		ipv4Event("eth0", 2, "192.0.2.1"),
+		ipv4Event("eth1", 3, "192.0.2.2"),
+	};
+	for (size_t i = 0; i < NELEMS(events); i++) {
+		if (update(updater, &events[i]) != 0) return -1;
+	}
+	int result = runUntilIdle(epoll_fd, &deadline, updater, &server);
+	if (result != 0) {
+		perror("Error running updater");
+	} else if (!requested(&server, "/update?iface=eth0&ip=192.0.2.1")
+	           || !requested(&server, "/update?iface=eth1&ip=192.0.2.2")) {
+		fputs("Not every interface's address was sent\n", stderr);
+		result = -1;
+	}
+
+	destroyUpdater(updater);
+	stopServer(&server);
+	return result;
+}
+
+// A retry still goes out while other events keep the loop from ever going idle
+static int testBusyRetry(int epoll_fd) {
+	struct Server server;
+	unsigned short port;
+	if (startServer(&server, epoll_fd, &port) != 0) {
+		perror("Couldn't start HTTP server");
+		return -1;
+	}
+	server.failures = 1;
+	server.busy = eventfd(1, EFD_CLOEXEC);
+	struct epoll_event busy = {.events = EPOLLIN, .data = {.ptr = &server.busy}};
+	if (server.busy == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server.busy, &busy) == -1) {
+		perror("Couldn't add busy fd");
+		return -1;
+	}
+	char url[128];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%hu/update?ip=<ipaddr>", port);
+	char const * const urls[] = {url};
+	struct Deadline deadline = {.set = false};
+	Updater_t updater = createWebUpdater(urls, NULL, NELEMS(urls), epoll_fd, &deadline, (struct WebUpdaterOptions) {
+		.hostname = "test",
+		.max_retries = 1,
+		.retry_base_ms = 10,
+		.retry_max_ms = 10,
+	});
+	if (updater == NULL) {
+		perror("Couldn't create updater");
+		return -1;
+	}
+
+	struct AddrEvent const event = ipv4Event("eth0", 2, "192.0.2.1");
+	if (update(updater, &event) != 0) return -1;
+	int result = runUntilIdle(epoll_fd, &deadline, updater, &server);
+	if (result != 0) {
+		perror("Error running updater");
+	} else if (server.n_paths != 2 || updaterStats(updater)->failed != 0) {
+		fprintf(stderr, "Expected a failed request and its retry, got %zu requests\n", server.n_paths);
+		result = -1;
+	}
+
+	destroyUpdater(updater);
+	stopServer(&server);
+	return result;
+}
+
+// Each target checks its own record, if it has one, and only sends what that record lacks
+static int testChecks(int epoll_fd) {
+	struct Server server;
+	struct DnsServer dns = {
+		.records = {
+			{"eth0.a.test", "192.0.2.1"},
+			{"eth1.a.test", "192.0.2.9"},
+		},
+		.n_records = 2,
+	};
+	unsigned short port, dns_port;
+	if (startServer(&server, epoll_fd, &port) != 0 || startDnsServer(&dns, epoll_fd, &dns_port) != 0) {
+		perror("Couldn't start servers");
+		return -1;
+	}
+	server.dns = &dns;
+	char url_a[128], url_b[128], check_server[32];
+	snprintf(url_a, sizeof(url_a), "http://127.0.0.1:%hu/a?iface=<iface>&ip=<ipaddr>", port);
+	snprintf(url_b, sizeof(url_b), "http://127.0.0.1:%hu/b?iface=<iface>&ip=<ipaddr>", port);
+	snprintf(check_server, sizeof(check_server), "127.0.0.1:%hu", dns_port);
+	char const * const urls[] = {url_a, url_b};
+	char const * const check_names[] = {"<iface>.a.test", NULL};
+	struct Deadline deadline = {.set = false};
+	Updater_t updater = createWebUpdater(urls, check_names, NELEMS(urls), epoll_fd, &deadline,
+	                                     (struct WebUpdaterOptions) {
+		.hostname = "test",
+		.check_server = check_server,
+	});
+	if (updater == NULL) {
+		perror("Couldn't create updater");
+		return -1;
+	}
+
+	struct AddrEvent const events[] = {
+		ipv4Event("eth0", 2, "192.0.2.1"),
+		ipv4Event("eth1", 3, "192.0.2.2"),
+	};
+	for (size_t i = 0; i < NELEMS(events); i++) {
+		if (update(updater, &events[i]) != 0) return -1;
+	}
+	int result = runUntilIdle(epoll_fd, &deadline, updater, &server);
+	if (result != 0) {
+		perror("Error running updater");
+	} else if (dns.queries != 2 || server.n_paths != 3 || requested(&server, "/a?iface=eth0&ip=192.0.2.1")
+	           || !requested(&server, "/a?iface=eth1&ip=192.0.2.2")
+	           || !requested(&server, "/b?iface=eth0&ip=192.0.2.1")
+	           || !requested(&server, "/b?iface=eth1&ip=192.0.2.2")) {
+		fprintf(stderr, "Expected 2 checks and 3 requests, got %u and %zu\n", dns.queries, server.n_paths);
+		result = -1;
+	}
+
+	destroyUpdater(updater);
+	stopServer(&server);
+	return result;
+}
+
+// A check that goes unanswered gives up in time, on its own, and the address is sent
+static int testCheckTimeout(int epoll_fd) {
+	struct Server server;
+	struct DnsServer dns = {.n_records = 0};
+	unsigned short port, dns_port;
+	if (startServer(&server, epoll_fd, &port) != 0 || startDnsServer(&dns, epoll_fd, &dns_port) != 0) {
+		perror("Couldn't start servers");
+		return -1;
+	}
+	server.dns = &dns;
+	char url[128], check_server[32];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%hu/update?ip=<ipaddr>", port);
+	snprintf(check_server, sizeof(check_server), "127.0.0.1:%hu", dns_port);
+	char const * const urls[] = {url};
+	char const * const check_names[] = {"silent.test"};
+	struct Deadline deadline = {.set = false};
+	Updater_t updater = createWebUpdater(urls, check_names, NELEMS(urls), epoll_fd, &deadline,
+	                                     (struct WebUpdaterOptions) {
+		.hostname = "test",
+		.check_server = check_server,
+	});
+	if (updater == NULL) {
+		perror("Couldn't create updater");
+		return -1;
+	}
+
+	struct AddrEvent const event = ipv4Event("eth0", 2, "192.0.2.1");
+	if (update(updater, &event) != 0) return -1;
+	int result = runUntilIdle(epoll_fd, &deadline, updater, &server);
+	if (result != 0) {
+		perror("Error running updater");
+	} else if (dns.queries != 1 || !requested(&server, "/update?ip=192.0.2.1")) {
+		fprintf(stderr, "Expected a check and the update, got %u and %zu\n", dns.queries, server.n_paths);
+		result = -1;
+	}
+
+	destroyUpdater(updater);
+	stopServer(&server);
+	return result;
+}
+
+int main(void) {
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) return EXIT_FAILURE;
+
+	if (testInterfaces(epoll_fd) != 0) {
+		fputs("FAIL: two interfaces on one URL\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testBusyRetry(epoll_fd) != 0) {
+		fputs("FAIL: retry on a busy loop\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testChecks(epoll_fd) != 0) {
+		fputs("FAIL: record checks per target\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (testCheckTimeout(epoll_fd) != 0) {
+		fputs("FAIL: unanswered record check\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	close(epoll_fd);
+	return EXIT_SUCCESS;
+}
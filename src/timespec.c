@@ -0,0 +1,34 @@
+#include "timespec.h"
+
+#define NSEC_PER_SEC 1000000000L
+#define NSEC_PER_MSEC 1000000L
+
+struct timespec timespecAddMs(struct timespec t, unsigned int ms) {
+	t.tv_sec += ms / 1000;
+	t.tv_nsec += (ms % 1000) * NSEC_PER_MSEC;
+	if (t.tv_nsec >= NSEC_PER_SEC) {
+		t.tv_sec++;
+		t.tv_nsec -= NSEC_PER_SEC;
+	}
+	return t;
+}
+
+struct timespec timespecAddNs(struct timespec t, unsigned long long ns) {
+	t.tv_sec += ns / NSEC_PER_SEC;
+	t.tv_nsec += ns % NSEC_PER_SEC;
+	if (t.tv_nsec >= NSEC_PER_SEC) {
+		t.tv_sec++;
+		t.tv_nsec -= NSEC_PER_SEC;
+	}
+	return t;
+}
+
+bool timespecBefore(struct timespec a, struct timespec b) {
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+long timespecUntilMs(struct timespec now, struct timespec then) {
+	if (!timespecBefore(now, then)) return 0;
+	long ns = (then.tv_sec - now.tv_sec) * NSEC_PER_SEC + (then.tv_nsec - now.tv_nsec);
+	return (ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+// A point in CLOCK_MONOTONIC time to wake up at, if set
+struct Deadline {
+	bool set;
+	struct timespec at;
+};
+
+struct timespec timespecAddMs(struct timespec t, unsigned int ms);
+struct timespec timespecAddNs(struct timespec t, unsigned long long ns);
+bool timespecBefore(struct timespec a, struct timespec b);
+// Milliseconds from now until then rounded up, 0 if then has passed
+long timespecUntilMs(struct timespec now, struct timespec then);
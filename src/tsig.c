@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+
+#include "tsig.h"
+#include "util.h"
+
+#define DNS_TYPE_TSIG 250
+#define DNS_CLASS_ANY 255
+#define TSIG_BADTIME 18
+
+struct TsigAlgorithm {
+	char const * name;
+	EVP_MD const * (*md)(void);
+};
+
+static struct TsigAlgorithm const algorithms[] = {
+	{"hmac-sha256", EVP_sha256},
+	{"hmac-sha512", EVP_sha512},
+	{"hmac-sha384", EVP_sha384},
+	{"hmac-sha224", EVP_sha224},
+	{"hmac-sha1", EVP_sha1},
+	{"hmac-md5.sig-alg.reg.int", EVP_md5},
+};
+
+int parseTsigKey(char const * spec, struct DnsKey * key) {
+	char const * secret = strrchr(spec, ':');
+	if (secret == NULL) goto invalid;
+	char const * name = spec;
+	char const * colon = memchr(spec, ':', secret - spec);
+	EVP_MD const * (*md)(void) = algorithms[0].md;
+	char const * algorithm = algorithms[0].name;
+	if (colon != NULL) {
+		md = NULL;
+		for (size_t i = 0; i < NELEMS(algorithms); i++) {
+			size_t len = strlen(algorithms[i].name);
+			// hmac-md5 is also known by its short name
+			size_t short_len = strcspn(algorithms[i].name, ".");
+			if ((size_t) (colon - spec) != len && (size_t) (colon - spec) != short_len) continue;
+			if (strncasecmp(spec, algorithms[i].name, colon - spec) != 0) continue;
+			md = algorithms[i].md;
+			algorithm = algorithms[i].name;
+		}
+		if (md == NULL) goto invalid;
+		name = colon + 1;
+	}
+
+	key->md = md();
+	key->name_len = encodeName(name, secret - name, key->name, true);
+	key->algorithm_len = encodeName(algorithm, strlen(algorithm), key->algorithm, true);
+	if (key->name_len == 0 || key->algorithm_len == 0) goto invalid;
+
+	secret++;
+	size_t secret_len = strlen(secret);
+	unsigned char decoded[DNS_MAX_SECRET * 2];
+	if (secret_len == 0 || secret_len % 4 != 0 || secret_len / 4 * 3 > sizeof(decoded)) goto invalid;
+	int decoded_len = EVP_DecodeBlock(decoded, (unsigned char const *) secret, secret_len);
+	if (decoded_len < 0) goto invalid;
+	// EVP_DecodeBlock counts padding as zero bytes
+	for (size_t i = secret_len; i > 0 && secret[i - 1] == '='; i--) decoded_len--;
+	if (decoded_len <= 0 || (size_t) decoded_len > sizeof(key->secret)) goto invalid;
+	memcpy(key->secret, decoded, decoded_len);
+	key->secret_len = decoded_len;
+	OPENSSL_cleanse(decoded, sizeof(decoded));
+	return 0;
+
+invalid:
+	key->md = NULL;
+	errno = EINVAL;
+	return -1;
+}
+
+// TSIG variables after the key name, RFC 8945 4.3.3
+static unsigned char * putTsigVariables(struct DnsKey const * key, unsigned char * p, uint64_t time_signed,
+                                        uint16_t error) {
+	p = put16(p, DNS_CLASS_ANY);
+	p = put32(p, 0);
+	p = putBytes(p, key->algorithm, key->algorithm_len);
+	p = put48(p, time_signed);
+	p = put16(p, TSIG_FUDGE);
+	p = put16(p, error);
+	return put16(p, 0);
+}
+
+size_t tsigSign(struct DnsKey const * key, unsigned char * message, size_t len, uint64_t time_signed,
+                unsigned char * mac, unsigned int * mac_len) {
+	unsigned char * digest_input = malloc(len + 2 * DNS_MAX_NAME + 32);
+	if (digest_input == NULL) return 0;
+	unsigned char * p = putBytes(digest_input, message, len);
+	p = putBytes(p, key->name, key->name_len);
+	p = putTsigVariables(key, p, time_signed, 0);
+	bool const signed_ok = HMAC(key->md, key->secret, key->secret_len, digest_input, p - digest_input,
+	                            mac, mac_len) != NULL;
+	free(digest_input);
+	if (!signed_ok) return 0;
+
+	p = putBytes(message + len, key->name, key->name_len);
+	p = put16(p, DNS_TYPE_TSIG);
+	p = put16(p, DNS_CLASS_ANY);
+	p = put32(p, 0);
+	unsigned char * rdlen = p;
+	p += 2;
+	p = putBytes(p, key->algorithm, key->algorithm_len);
+	p = put48(p, time_signed);
+	p = put16(p, TSIG_FUDGE);
+	p = put16(p, *mac_len);
+	p = putBytes(p, mac, *mac_len);
+	// Original ID, error and other length
+	p = put16(p, get16(message));
+	p = put16(p, 0);
+	p = put16(p, 0);
+	put16(rdlen, p - rdlen - 2);
+
+	// ARCOUNT
+	put16(message + 10, get16(message + 10) + 1);
+	return p - message;
+}
+
+bool tsigVerify(struct DnsKey const * key, unsigned char const * request_mac, unsigned int request_mac_len,
+                unsigned char const * reply, size_t len, uint64_t now, uint16_t * tsig_error) {
+	unsigned char const * end = reply + len;
+	unsigned int counts[4];
+	for (size_t i = 0; i < NELEMS(counts); i++) counts[i] = get16(reply + 4 + 2 * i);
+	if (counts[3] == 0) return false;
+
+	// The TSIG is the last record
+	unsigned char const * p = reply + DNS_HEADER_LEN;
+	for (unsigned int i = 0; i < counts[0] && p != NULL; i++) {
+		p = skipName(p, end);
+		if (p != NULL) p = p + 4 <= end ? p + 4 : NULL;
+	}
+	unsigned int n_records = counts[1] + counts[2] + counts[3] - 1;
+	for (unsigned int i = 0; i < n_records && p != NULL; i++) {
+		p = skipName(p, end);
+		if (p == NULL || p + 10 > end) return false;
+		p += 10 + get16(p + 8);
+	}
+	if (p == NULL || p >= end) return false;
+	unsigned char const * tsig = p;
+
+	bool is_key;
+	p = compareName(reply, end, p, key->name, &is_key);
+	if (p == NULL || !is_key || p + 10 > end || get16(p) != DNS_TYPE_TSIG) return false;
+	unsigned char const * rdata = p + 10;
+	unsigned char const * rdata_end = rdata + get16(p + 8);
+	if (rdata_end > end) return false;
+
+	size_t const alg_len = key->algorithm_len;
+	if ((size_t) (rdata_end - rdata) < alg_len + 10
+	    || memcmp(rdata, key->algorithm, alg_len) != 0) return false;
+	p = rdata + alg_len;
+	uint64_t time_signed = (uint64_t) get16(p) << 32 | (uint32_t) get16(p + 2) << 16 | get16(p + 4);
+	uint16_t mac_len = get16(p + 8);
+	unsigned char const * mac = p + 10;
+	p = mac + mac_len;
+	if (p + 6 > rdata_end) return false;
+	uint16_t original_id = get16(p);
+	*tsig_error = get16(p + 2);
+	uint16_t other_len = get16(p + 4);
+	if (p + 6 + other_len != rdata_end) return false;
+	if (mac_len != request_mac_len) return false;
+
+	unsigned char * digest_input = malloc(2 + request_mac_len + (tsig - reply) + 2 * DNS_MAX_NAME + 32 + other_len);
+	if (digest_input == NULL) return false;
+	unsigned char * q = put16(digest_input, request_mac_len);
+	q = putBytes(q, request_mac, request_mac_len);
+	unsigned char * header = q;
+	q = putBytes(q, reply, tsig - reply);
+	put16(header, original_id);
+	put16(header + 10, counts[3] - 1);
+	q = putBytes(q, key->name, key->name_len);
+	q = putBytes(q, rdata - 8, 6);
+	q = putBytes(q, rdata, alg_len + 8);
+	q = putBytes(q, p + 2, 4 + other_len);
+
+	unsigned char expected[EVP_MAX_MD_SIZE];
+	unsigned int expected_len;
+	bool valid = HMAC(key->md, key->secret, key->secret_len, digest_input,
+	                  q - digest_input, expected, &expected_len) != NULL
+		&& expected_len == mac_len && CRYPTO_memcmp(expected, mac, mac_len) == 0;
+	free(digest_input);
+	if (!valid) return false;
+
+	if ((now > time_signed ? now - time_signed : time_signed - now) > TSIG_FUDGE) {
+		*tsig_error = TSIG_BADTIME;
+		return false;
+	}
+	return true;
+}
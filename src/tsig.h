@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <openssl/evp.h>
+
+#include "dns.h"
+
+// Transaction signatures, RFC 8945
+
+// Largest TSIG secret accepted, longer keys are hashed down anyway
+#define DNS_MAX_SECRET 128
+// Seconds a signature's time may be off
+#define TSIG_FUDGE 300
+// Most a TSIG record adds to a message
+#define TSIG_MAX_LEN (DNS_MAX_NAME * 2 + 16 + EVP_MAX_MD_SIZE)
+
+struct DnsKey {
+	// Canonical (lowercase) wire format
+	unsigned char name[DNS_MAX_NAME];
+	size_t name_len;
+	unsigned char algorithm[DNS_MAX_NAME];
+	size_t algorithm_len;
+	EVP_MD const * md;
+	unsigned char secret[DNS_MAX_SECRET];
+	size_t secret_len;
+};
+
+// [algorithm:]name:secret, as nsupdate -y
+int parseTsigKey(char const * spec, struct DnsKey * key);
+// Append a TSIG record signed at time_signed to the len bytes of message, which has room for
+// TSIG_MAX_LEN more. Returns the signed length, with the MAC the reply is signed over in mac, or 0.
+size_t tsigSign(struct DnsKey const * key, unsigned char * message, size_t len, uint64_t time_signed,
+                unsigned char * mac, unsigned int * mac_len);
+// Check the reply's TSIG against the request's MAC, and its time against now. tsig_error gets the
+// error it carries, or BADTIME.
+bool tsigVerify(struct DnsKey const * key, unsigned char const * request_mac, unsigned int request_mac_len,
+                unsigned char const * reply, size_t len, uint64_t now, uint16_t * tsig_error);
@@ -1,19 +1,24 @@
 #include <stdlib.h>
 
 #include "updater.h"
+#include "probes.h"
 
-Updater_t createPrintUpdater() {
-	Updater_t updater = malloc(sizeof(*updater));
-	updater->tag = PRINT_UPDATER;
-	return updater;
-}
-
-int update(Updater_t updater, struct IPAddr addr) {
+int update(Updater_t updater, struct AddrEvent const * event) {
+	// Queued, it fires on the other side, once per change
+	if (updater->tag != QUEUE_UPDATER) {
+		PROBE(update, event->ifindex, event->addr.af, &event->addr, probeTimestamp(event->received));
+	}
 	switch (updater->tag) {
 	case PRINT_UPDATER:
-		return printAddr(addr);
+		return printUpdate(&updater->print, event);
 	case WEB_UPDATER:
-		return webUpdate(&updater->web, addr);
+		return webUpdate(&updater->web, event);
+	case DNS_UPDATER:
+		return dnsUpdate(&updater->dns, event);
+	case EXEC_UPDATER:
+		return execUpdate(&updater->exec, event);
+	case QUEUE_UPDATER:
+		return queueUpdate(&updater->queue, event);
 	};
 	// Should be unreachable
 	return -2;
@@ -25,6 +30,12 @@ int handleMessage(Updater_t updater, int fd, int32_t events) {
 		return -2;
 	case WEB_UPDATER:
 		return handleWebMessage(&updater->web, fd, events);
+	case DNS_UPDATER:
+		return handleDnsMessage(&updater->dns, fd, events);
+	case EXEC_UPDATER:
+		return handleExecMessage(&updater->exec, fd, events);
+	case QUEUE_UPDATER:
+		return -2;
 	}
 	return -2;
 };
@@ -32,7 +43,10 @@ int handleMessage(Updater_t updater, int fd, int32_t events) {
 int handleTimeout(Updater_t updater) {
 	switch (updater->tag) {
 	case PRINT_UPDATER:
-		// Unreachable
+	case DNS_UPDATER:
+	case EXEC_UPDATER:
+	case QUEUE_UPDATER:
+		// Unreachable, these have their own timerfd or none
 		return -2;
 	case WEB_UPDATER:
 		return handleWebTimeout(&updater->web);
@@ -40,6 +54,66 @@ int handleTimeout(Updater_t updater) {
 	return -2;
 }
 
+int flushUpdater(Updater_t updater) {
+	switch (updater->tag) {
+	case PRINT_UPDATER:
+		return flushPrintUpdater(&updater->print);
+	case WEB_UPDATER:
+	case DNS_UPDATER:
+	case EXEC_UPDATER:
+		return 0;
+	case QUEUE_UPDATER:
+		return flushQueueUpdater(&updater->queue);
+	}
+	return 0;
+}
+
+int prepareUpdater(Updater_t updater) {
+	switch (updater->tag) {
+	case PRINT_UPDATER:
+	case DNS_UPDATER:
+	case EXEC_UPDATER:
+		return 0;
+	case WEB_UPDATER:
+		return prepareWebUpdater(&updater->web);
+	case QUEUE_UPDATER:
+		return prepareQueueUpdater(&updater->queue);
+	}
+	return 0;
+}
+
+bool updaterIdle(Updater_t updater) {
+	switch (updater->tag) {
+	case PRINT_UPDATER:
+		return true;
+	case WEB_UPDATER:
+		return webUpdaterIdle(&updater->web);
+	case DNS_UPDATER:
+		return dnsUpdaterIdle(&updater->dns);
+	case EXEC_UPDATER:
+		return execUpdaterIdle(&updater->exec);
+	case QUEUE_UPDATER:
+		return true;
+	}
+	return true;
+}
+
+struct UpdaterStats const * updaterStats(Updater_t updater) {
+	switch (updater->tag) {
+	case PRINT_UPDATER:
+		return &updater->print.stats;
+	case WEB_UPDATER:
+		return &updater->web.stats;
+	case DNS_UPDATER:
+		return &updater->dns.stats;
+	case EXEC_UPDATER:
+		return &updater->exec.stats;
+	case QUEUE_UPDATER:
+		return &updater->queue.stats;
+	}
+	return NULL;
+}
+
 void destroyUpdater(Updater_t updater) {
 	switch (updater->tag) {
 	case PRINT_UPDATER:
@@ -47,6 +121,14 @@ void destroyUpdater(Updater_t updater) {
 	case WEB_UPDATER:
 		destroyWebUpdater(&updater->web);
 		break;
+	case DNS_UPDATER:
+		destroyDnsUpdater(&updater->dns);
+		break;
+	case EXEC_UPDATER:
+		destroyExecUpdater(&updater->exec);
+		break;
+	case QUEUE_UPDATER:
+		break;
 	};
 	free(updater);
 }
@@ -3,27 +3,47 @@
 typedef struct Updater * Updater_t;
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "ipaddr.h"
 #include "web_updater.h"
-
-struct PrintUpdater {};
+#include "dns_updater.h"
+#include "print_updater.h"
+#include "exec_updater.h"
+#include "queue.h"
+#include "stats.h"
 
 enum UpdaterType {
 	PRINT_UPDATER,
 	WEB_UPDATER,
+	DNS_UPDATER,
+	EXEC_UPDATER,
+	// Hands events to another thread's updater
+	QUEUE_UPDATER,
 };
 
 struct Updater {
 	enum UpdaterType tag;
 	union {
 		struct WebUpdater web;
+		struct DnsUpdater dns;
+		struct ExecUpdater exec;
+		struct QueueUpdater queue;
 		struct PrintUpdater print;
 	};
 };
 
-Updater_t createPrintUpdater();
-int update(Updater_t updater, struct IPAddr addr);
+// Returned by update when the event can't be taken right now, to be offered again later
+#define UPDATE_BUSY 1
+
+int update(Updater_t updater, struct AddrEvent const * event);
 int handleMessage(Updater_t updater, int fd, int32_t events);
 int handleTimeout(Updater_t updater);
+// Write out anything buffered, at the end of each batch of events
+int flushUpdater(Updater_t updater);
+// A change is on its way, e.g. while addresses settle, so get ready to send it
+int prepareUpdater(Updater_t updater);
+// No requests in flight or waiting to be retried
+bool updaterIdle(Updater_t updater);
+struct UpdaterStats const * updaterStats(Updater_t updater);
 
 void destroyUpdater(Updater_t updater);
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+int createUring(struct Uring * uring, unsigned int entries) {
+	memset(uring, 0, sizeof(*uring));
+	uring->ring = MAP_FAILED;
+	uring->sqes = MAP_FAILED;
+
+	// Completions are posted when we next enter the kernel, rather than interrupting whatever syscall
+	// the thread is in. Linux 5.19, as are the buffer rings.
+	struct io_uring_params params = {.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG};
+	uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (uring->fd == -1 && errno == EINVAL) errno = ENOSYS;
+	if (uring->fd == -1) return -1;
+	// Linux 5.4, older kernels lack the rest we need anyway
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		errno = ENOSYS;
+		goto cleanup;
+	}
+
+	size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->ring_len = sq_len > cq_len ? sq_len : cq_len;
+	uring->ring = mmap(NULL, uring->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd,
+	                   IORING_OFF_SQ_RING);
+	if (uring->ring == MAP_FAILED) goto cleanup;
+	uring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd,
+	                   IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) goto cleanup;
+
+	char * ring = uring->ring;
+	uring->sq_head = (unsigned int *) (ring + params.sq_off.head);
+	uring->sq_tail = (unsigned int *) (ring + params.sq_off.tail);
+	uring->sq_mask = *(unsigned int *) (ring + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned int *) (ring + params.sq_off.array);
+	uring->sq_flags = (unsigned int *) (ring + params.sq_off.flags);
+	uring->cq_head = (unsigned int *) (ring + params.cq_off.head);
+	uring->cq_tail = (unsigned int *) (ring + params.cq_off.tail);
+	uring->cq_mask = *(unsigned int *) (ring + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+	return 0;
+
+cleanup:
+	destroyUring(uring);
+	return -1;
+}
+
+void destroyUring(struct Uring * uring) {
+	if (uring->sqes != MAP_FAILED) munmap(uring->sqes, uring->sqes_len);
+	uring->sqes = MAP_FAILED;
+	if (uring->ring != MAP_FAILED) munmap(uring->ring, uring->ring_len);
+	uring->ring = MAP_FAILED;
+	// Cancels anything still in flight
+	if (uring->fd >= 0) close(uring->fd);
+	uring->fd = -1;
+}
+
+struct io_uring_sqe * uringSqe(struct Uring * uring) {
+	unsigned int tail = *uring->sq_tail;
+	unsigned int head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head > uring->sq_mask) return NULL;
+
+	unsigned int index = tail & uring->sq_mask;
+	struct io_uring_sqe * sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->to_submit++;
+	return sqe;
+}
+
+int uringSubmit(struct Uring * uring) {
+	while (uring->to_submit > 0) {
+		int submitted = syscall(__NR_io_uring_enter, uring->fd, uring->to_submit, 0, 0, NULL, 0);
+		__atomic_store_n(&uring->syscalls, uring->syscalls + 1, __ATOMIC_RELAXED);
+		if (submitted == -1 && errno == EINTR) continue;
+		if (submitted == -1) return -1;
+		uring->to_submit -= submitted;
+	}
+	return 0;
+}
+
+int uringRunTaskWork(struct Uring * uring) {
+	if (!(__atomic_load_n(uring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_TASKRUN)) return 0;
+	// Submits along the way
+	int submitted = syscall(__NR_io_uring_enter, uring->fd, uring->to_submit, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+	__atomic_store_n(&uring->syscalls, uring->syscalls + 1, __ATOMIC_RELAXED);
+	if (submitted == -1 && errno != EINTR) return -1;
+	if (submitted > 0) uring->to_submit -= submitted;
+	return 0;
+}
+
+void uringDiscard(struct Uring * uring) {
+	// Without SQPOLL, the kernel only reads the queue within io_uring_enter
+	__atomic_store_n(uring->sq_tail, *uring->sq_tail - uring->to_submit, __ATOMIC_RELEASE);
+	uring->to_submit = 0;
+}
+
+struct io_uring_cqe const * uringPeek(struct Uring * uring) {
+	unsigned int head = *uring->cq_head;
+	if (head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+	return &uring->cqes[head & uring->cq_mask];
+}
+
+void uringSeen(struct Uring * uring) {
+	__atomic_store_n(uring->cq_head, *uring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int createUringBuffers(struct Uring * uring, struct UringBuffers * buffers, uint16_t group, unsigned int n,
+                       unsigned int buf_len) {
+	buffers->n = n;
+	buffers->buf_len = buf_len;
+	buffers->group = group;
+	buffers->tail = 0;
+	buffers->bufs = NULL;
+	// Shared with the kernel, so page aligned
+	buffers->ring_len = n * sizeof(struct io_uring_buf);
+	buffers->ring = mmap(NULL, buffers->ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffers->ring == MAP_FAILED) return -1;
+	buffers->bufs = malloc((size_t) n * buf_len);
+	if (buffers->bufs == NULL) goto cleanup;
+
+	// Linux 5.19
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uintptr_t) buffers->ring,
+		.ring_entries = n,
+		.bgid = group,
+	};
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) goto cleanup;
+	for (unsigned int i = 0; i < n; i++) uringRecycle(buffers, i);
+	return 0;
+
+cleanup:
+	destroyUringBuffers(buffers);
+	return -1;
+}
+
+void destroyUringBuffers(struct UringBuffers * buffers) {
+	if (buffers->ring != MAP_FAILED) munmap(buffers->ring, buffers->ring_len);
+	buffers->ring = MAP_FAILED;
+	free(buffers->bufs);
+	buffers->bufs = NULL;
+}
+
+char * uringBuffer(struct UringBuffers const * buffers, uint16_t id) {
+	return buffers->bufs + (size_t) id * buffers->buf_len;
+}
+
+void uringRecycle(struct UringBuffers * buffers, uint16_t id) {
+	struct io_uring_buf * buf = &buffers->ring->bufs[buffers->tail & (buffers->n - 1)];
+	buf->addr = (uintptr_t) uringBuffer(buffers, id);
+	buf->len = buffers->buf_len;
+	buf->bid = id;
+	buffers->tail++;
+	__atomic_store_n(&buffers->ring->tail, buffers->tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+// Just enough io_uring for the monitor, on raw syscalls so there's no
+// dependency on liburing. Single threaded: one submitter, one reaper.
+struct Uring {
+	int fd;
+	unsigned int * sq_head;
+	unsigned int * sq_tail;
+	unsigned int sq_mask;
+	unsigned int * sq_array;
+	unsigned int * sq_flags;
+	struct io_uring_sqe * sqes;
+	unsigned int * cq_head;
+	unsigned int * cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe * cqes;
+	// SQEs filled in since the last submit
+	unsigned int to_submit;
+
+	void * ring;
+	size_t ring_len;
+	size_t sqes_len;
+	// io_uring_enter calls, for comparison with epoll. Stored atomically, other threads may read it.
+	unsigned long long syscalls;
+};
+
+// Buffers the kernel picks from for multishot receives
+struct UringBuffers {
+	struct io_uring_buf_ring * ring;
+	size_t ring_len;
+	char * bufs;
+	unsigned int n;
+	unsigned int buf_len;
+	uint16_t group;
+	uint16_t tail;
+};
+
+// Returns -1 with errno ENOSYS or EPERM if io_uring is unavailable
+int createUring(struct Uring * uring, unsigned int entries);
+void destroyUring(struct Uring * uring);
+// Zeroed SQE to fill in, NULL if the submission queue is full
+struct io_uring_sqe * uringSqe(struct Uring * uring);
+int uringSubmit(struct Uring * uring);
+// Post completions the kernel holds back until we enter it, if there are any
+int uringRunTaskWork(struct Uring * uring);
+// Take back the SQEs filled in since the last submit, the kernel never sees them
+void uringDiscard(struct Uring * uring);
+// Next completion, NULL if none. Consume it with uringSeen.
+struct io_uring_cqe const * uringPeek(struct Uring * uring);
+void uringSeen(struct Uring * uring);
+
+// n must be a power of two
+int createUringBuffers(struct Uring * uring, struct UringBuffers * buffers, uint16_t group, unsigned int n,
+                       unsigned int buf_len);
+void destroyUringBuffers(struct UringBuffers * buffers);
+char * uringBuffer(struct UringBuffers const * buffers, uint16_t id);
+// Hand a buffer back to the kernel once done with it
+void uringRecycle(struct UringBuffers * buffers, uint16_t id);
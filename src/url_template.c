@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "url_template.h"
+#include "util.h"
+
+static struct {
+	char const * tag;
+	enum SegmentType type;
+	// Longest substitution, excluding the NULL
+	size_t max_len;
+} const placeholders[] = {
+	{"<ipaddr>", SEGMENT_IPADDR, INET6_ADDRSTRLEN - 1},
+	{"<ipv4>", SEGMENT_IPV4, INET_ADDRSTRLEN - 1},
+	{"<ipv6>", SEGMENT_IPV6, INET6_ADDRSTRLEN - 1},
+	// Known addresses of both families, comma separated
+	{"<ipaddrs>", SEGMENT_IPADDRS, INET_ADDRSTRLEN + INET6_ADDRSTRLEN - 1},
+	// Every character may need percent-encoding
+	{"<iface>", SEGMENT_IFACE, 3 * (IF_NAMESIZE - 1)},
+	{"<prefixlen>", SEGMENT_PREFIXLEN, 3},
+	// Substituted with a literal segment
+	{"<hostname>", SEGMENT_LITERAL, 0},
+};
+
+static bool unreserved(char c) {
+	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+		|| c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+// dst must hold 3 * strlen(src) bytes, returns the number written
+static size_t urlEncode(char const * src, char * dst) {
+	static char const hex[] = "0123456789ABCDEF";
+	char * pos = dst;
+	for (; *src != '\0'; src++) {
+		if (unreserved(*src)) {
+			*pos++ = *src;
+		} else {
+			*pos++ = '%';
+			*pos++ = hex[(unsigned char) *src >> 4];
+			*pos++ = hex[(unsigned char) *src & 0xF];
+		}
+	}
+	return pos - dst;
+}
+
+static bool addSegment(struct UrlTemplate * tmpl, enum SegmentType type, char const * text, size_t len) {
+	if (type == SEGMENT_LITERAL && len == 0) return true;
+	struct TemplateSegment * segments = realloc(tmpl->segments, (tmpl->n_segments + 1) * sizeof(*segments));
+	if (segments == NULL) return false;
+	tmpl->segments = segments;
+	tmpl->segments[tmpl->n_segments++] = (struct TemplateSegment) {.type = type, .text = text, .len = len};
+	return true;
+}
+
+int parseTemplate(struct UrlTemplate * tmpl, char const * src, char const * hostname) {
+	tmpl->segments = NULL;
+	tmpl->n_segments = 0;
+	tmpl->max_len = 1;
+	tmpl->hostname = malloc(3 * strlen(hostname) + 1);
+	if (tmpl->hostname == NULL) return -1;
+	size_t const hostname_len = urlEncode(hostname, tmpl->hostname);
+
+	char const * literal = src;
+	char const * pos = src;
+	while ((pos = strchr(pos, '<')) != NULL) {
+		size_t i;
+		for (i = 0; i < NELEMS(placeholders); i++) {
+			if (strncmp(pos, placeholders[i].tag, strlen(placeholders[i].tag)) == 0) break;
+		}
+		if (i == NELEMS(placeholders)) {
+			pos++;
+			continue;
+		}
+
+		if (!addSegment(tmpl, SEGMENT_LITERAL, literal, pos - literal)) goto cleanup;
+		tmpl->max_len += pos - literal;
+		if (placeholders[i].type == SEGMENT_LITERAL) {
+			if (!addSegment(tmpl, SEGMENT_LITERAL, tmpl->hostname, hostname_len)) goto cleanup;
+			tmpl->max_len += hostname_len;
+		} else {
+			if (!addSegment(tmpl, placeholders[i].type, NULL, 0)) goto cleanup;
+			tmpl->max_len += placeholders[i].max_len;
+		}
+		pos += strlen(placeholders[i].tag);
+		literal = pos;
+	}
+	size_t const tail_len = strlen(literal);
+	if (!addSegment(tmpl, SEGMENT_LITERAL, literal, tail_len)) goto cleanup;
+	tmpl->max_len += tail_len;
+
+	return 0;
+
+cleanup:
+	destroyTemplate(tmpl);
+	return -1;
+}
+
+bool renderTemplate(struct UrlTemplate const * tmpl, struct AddrEvent const * event, char * dst, size_t size) {
+	if (size < tmpl->max_len) {
+		errno = ENOSPC;
+		return false;
+	}
+
+	char * pos = dst;
+	for (size_t i = 0; i < tmpl->n_segments; i++) {
+		struct TemplateSegment const * segment = &tmpl->segments[i];
+		switch (segment->type) {
+		case SEGMENT_LITERAL:
+			memcpy(pos, segment->text, segment->len);
+			pos += segment->len;
+			break;
+		case SEGMENT_IPADDR:
+			pos += formatAddr(&event->addr, pos);
+			break;
+		case SEGMENT_IPV4:
+			pos += formatAddr(&event->ipv4, pos);
+			break;
+		case SEGMENT_IPV6:
+			pos += formatAddr(&event->ipv6, pos);
+			break;
+		case SEGMENT_IPADDRS: {
+			char * start = pos;
+			pos += formatAddr(&event->ipv4, pos);
+			if (pos != start && event->ipv6.af != AF_UNSPEC) *pos++ = ',';
+			pos += formatAddr(&event->ipv6, pos);
+			break;
+		}
+		case SEGMENT_IFACE:
+			if (event->iface != NULL) pos += urlEncode(event->iface, pos);
+			break;
+		case SEGMENT_PREFIXLEN: {
+			unsigned char prefixlen = event->addr.prefixlen;
+			if (prefixlen >= 100) *pos++ = '0' + prefixlen / 100;
+			if (prefixlen >= 10) *pos++ = '0' + prefixlen / 10 % 10;
+			*pos++ = '0' + prefixlen % 10;
+			break;
+		}}
+	}
+	*pos = '\0';
+
+	return true;
+}
+
+void destroyTemplate(struct UrlTemplate * tmpl) {
+	free(tmpl->segments);
+	tmpl->segments = NULL;
+	tmpl->n_segments = 0;
+	free(tmpl->hostname);
+	tmpl->hostname = NULL;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ipaddr.h"
+
+enum SegmentType {
+	SEGMENT_LITERAL,
+	SEGMENT_IPADDR,
+	SEGMENT_IPV4,
+	SEGMENT_IPV6,
+	SEGMENT_IPADDRS,
+	SEGMENT_IFACE,
+	SEGMENT_PREFIXLEN,
+};
+
+struct TemplateSegment {
+	enum SegmentType type;
+	// Literal text, not NULL terminated
+	char const * text;
+	size_t len;
+};
+
+// A URL parsed once into literal text and placeholders, so rendering is a
+// single pass over the segments with no searching or allocation
+struct UrlTemplate {
+	struct TemplateSegment * segments;
+	size_t n_segments;
+	// Upper bound on a rendered URL, including the trailing NULL
+	size_t max_len;
+	// URL-encoded <hostname>, substituted at parse time
+	char * hostname;
+};
+
+// Placeholders are <ipaddr>, <ipv4>, <ipv6>, <ipaddrs>, <iface>, <prefixlen> and
+// <hostname>, anything else is copied through as is. iface and hostname are URL-encoded.
+int parseTemplate(struct UrlTemplate * tmpl, char const * src, char const * hostname);
+// dst must hold at least tmpl->max_len bytes
+bool renderTemplate(struct UrlTemplate const * tmpl, struct AddrEvent const * event, char * dst, size_t size);
+void destroyTemplate(struct UrlTemplate * tmpl);
@@ -3,11 +3,23 @@
 #define NELEMS(x) (sizeof(x) / sizeof(*x))
 
 #include "monitor.h"
+#include "record.h"
+#include "metrics.h"
 
 
 enum EpollTag {
 	EPOLL_MONITOR,
+	EPOLL_MONITOR_TIMER,
+	EPOLL_MONITOR_URING,
 	EPOLL_WEB_UPDATER,
+	EPOLL_REPLAY,
+	EPOLL_DNS_UPDATER,
+	EPOLL_METRICS,
+	EPOLL_EXEC_UPDATER,
+	EPOLL_QUEUE,
+	EPOLL_STOP,
+	EPOLL_SIGNAL,
+	EPOLL_RECONFIGURE,
 };
 
 struct EpollData {
@@ -17,5 +29,12 @@ struct EpollData {
 	union {
 		Monitor_t monitor;
 		struct WebUpdater * web_updater;
+		struct DnsUpdater * dns_updater;
+		struct ExecUpdater * exec_updater;
+		Replay_t replay;
+		MetricsServer_t metrics;
+		struct EventQueue * queue;
+		struct Reloader * reloader;
+		struct FilterHandoff * handoff;
 	};
 };
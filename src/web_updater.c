@@ -2,54 +2,16 @@
 #include <errno.h>
 
 #include <string.h>
-#ifndef HAVE_strlcpy
-#include "strlcpy.h"
-#define HAVE_strlcpy
-#endif
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/epoll.h>
+#include <unistd.h>
 
 #include "web_updater.h"
 #include "util.h"
-
-char const * const ip_tag = "<ipaddr>";
-
-bool templateUrl(struct IPAddr address, char const * src, char * dst, size_t max_size){
-	const size_t tag_len = strlen(ip_tag);
-
-	char * write_pos = dst;
-	const char * read_pos = src;
-	const char * tag_pos = src;
-
-	while ((tag_pos = strstr(read_pos, ip_tag)) != NULL){
-		size_t copy_len = tag_pos - read_pos;
-		if (copy_len > max_size) {
-			errno = ENOSPC;
-			return false;
-		}
-		memcpy(write_pos, read_pos, copy_len);
-		write_pos += copy_len;
-		max_size -= copy_len;
-
-		if (inet_ntop(address.af, &address, write_pos, max_size) == NULL) {
-			return false;
-		}
-		size_t ip_len = strlen(write_pos);
-		write_pos += ip_len;
-		max_size -= ip_len;
-
-		read_pos = tag_pos + tag_len;
-	}
-
-	if (strlcpy(write_pos, read_pos, max_size) >= max_size){
-		errno = ENOSPC;
-		return false;
-	}
-
-	return true;
-}
+#include "timespec.h"
+#include "probes.h"
 
 static size_t discard(__attribute__((unused)) char *ptr,
                       size_t size, size_t nmemb,
@@ -67,7 +29,10 @@ static int socket_cb(CURL* handle, curl_socket_t socket, int what, void *cb_data
 
 	if (what == CURL_POLL_REMOVE) {
 		free(socket_data);
-		return epoll_ctl(updater->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+		// Superseded requests may have closed the socket already, which
+		// removed it from epoll anyway
+		if (epoll_ctl(updater->epoll_fd, EPOLL_CTL_DEL, socket, NULL) == -1 && errno != EBADF) return -1;
+		return 0;
 	} else {
 		struct epoll_event ev = {
 			.events = 0,
@@ -96,51 +61,223 @@ static int socket_cb(CURL* handle, curl_socket_t socket, int what, void *cb_data
 	};
 }
 
-static int timer_cb(CURLM* multi_handle, long timeout, void* cb_data) {
+// Point the main loop at whichever comes first, curl's timer, a retry or a record check giving up
+static int setDeadline(struct WebUpdater * updater) {
+	bool have_deadline = updater->curl_timer;
+	struct timespec deadline = updater->curl_deadline;
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		struct WebTarget const * target = updater->targets[i];
+		for (size_t j = 0; j < target->n_requests; j++) {
+			struct WebRequest const * request = target->requests[j];
+			if (!request->deferred) continue;
+			if (!have_deadline || timespecBefore(request->start_at, deadline)) deadline = request->start_at;
+			have_deadline = true;
+		}
+	}
+	struct timespec check_deadline;
+	if (updater->check.fd >= 0 && dnsCheckDeadline(&updater->check, &check_deadline)) {
+		if (!have_deadline || timespecBefore(check_deadline, deadline)) deadline = check_deadline;
+		have_deadline = true;
+	}
+
+	// Absolute, the loop works out how long that is each time it waits
+	*updater->deadline = (struct Deadline) {.set = have_deadline, .at = deadline};
+	return 0;
+}
+
+static int timer_cb(__attribute__((unused)) CURLM* multi_handle, long timeout, void* cb_data) {
 	struct WebUpdater * updater = cb_data;
 
 	if (timeout == -1) {
 		// Get rid of timeout
-		*updater->timeout = -1;
+		updater->curl_timer = false;
 	} else {
-		*updater->timeout = timeout;
+		if (clock_gettime(CLOCK_MONOTONIC, &updater->curl_deadline) == -1) return -1;
+		updater->curl_deadline = timespecAddMs(updater->curl_deadline, timeout);
+		updater->curl_timer = true;
 	}
 
+	return setDeadline(updater);
+}
+
+// Options every request shares
+static int initHandle(struct WebUpdater const * updater, struct WebRequest * request) {
+	if ((request->handle = curl_easy_init()) == NULL) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_PRIVATE, request) != CURLE_OK) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_SHARE, updater->share) != CURLE_OK) return -1;
+	// Where available, so both families of a target, or several targets on one host, share a
+	// connection rather than each opening their own
+	curl_easy_setopt(request->handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+	if (curl_easy_setopt(request->handle, CURLOPT_PIPEWAIT, 1L) != CURLE_OK) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_TCP_KEEPALIVE, 1L) != CURLE_OK) return -1;
 	return 0;
 }
 
-Updater_t createWebUpdater(char const * template, int epoll_fd, int * timeout, struct WebUpdaterOptions options) {
+// Combined events carry every family, so replace either request
+static size_t requestIndex(struct AddrEvent const * event) {
+	return event->combined || event->addr.af == AF_INET ? 0 : 1;
+}
+
+// Whether two changes go to the same request, being of the same interface and family
+static bool sameRequest(struct AddrEvent const * a, struct AddrEvent const * b) {
+	return a->netns == b->netns && a->ifindex == b->ifindex && requestIndex(a) == requestIndex(b);
+}
+
+// Unless a request in flight might still overwrite it
+static bool requestBusy(struct WebRequest const * request) {
+	return request->active || request->deferred || request->checking;
+}
+
+static bool monitored(struct AddrFilter const * filter, struct AddrEvent const * event) {
+	bool const family = event->addr.af == AF_INET ? filter->ipv4 : filter->ipv6;
+	return family && filterIfaceSlot(filter, event->netns, event->ifindex) >= 0;
+}
+
+// The target's scheme, host and port, without credentials or anything after
+static char * targetOrigin(struct WebTarget const * target) {
+	char * origin = NULL;
+	struct AddrEvent const blank = {.iface = ""};
+	char * url = malloc(target->url_len);
+	CURLU * parts = curl_url();
+	if (url == NULL || parts == NULL || !renderTemplate(&target->template, &blank, url, target->url_len)) goto cleanup;
+	if (curl_url_set(parts, CURLUPART_URL, url, CURLU_GUESS_SCHEME) != CURLUE_OK
+	    || curl_url_set(parts, CURLUPART_USER, NULL, 0) != CURLUE_OK
+	    || curl_url_set(parts, CURLUPART_PASSWORD, NULL, 0) != CURLUE_OK
+	    || curl_url_set(parts, CURLUPART_PATH, "/", 0) != CURLUE_OK
+	    || curl_url_set(parts, CURLUPART_QUERY, NULL, 0) != CURLUE_OK
+	    || curl_url_set(parts, CURLUPART_FRAGMENT, NULL, 0) != CURLUE_OK) goto cleanup;
+	char * curl_origin;
+	if (curl_url_get(parts, CURLUPART_URL, &curl_origin, 0) != CURLUE_OK) goto cleanup;
+	origin = strdup(curl_origin);
+	curl_free(curl_origin);
+
+cleanup:
+	curl_url_cleanup(parts);
+	free(url);
+	return origin;
+}
+
+static int initWarmup(struct WebUpdater * updater, struct WebTarget * target) {
+	struct WebRequest * request = &target->warmup;
+	request->target = target;
+	request->preconnect = true;
+	if ((request->url = targetOrigin(target)) == NULL) return -1;
+	if (initHandle(updater, request) != 0) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_URL, request->url) != CURLE_OK) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_NOBODY, 1L) != CURLE_OK) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_WRITEFUNCTION, discard) != CURLE_OK) return -1;
+	// Over the network as it is now, not a pooled connection from before the change
+	if (curl_easy_setopt(request->handle, CURLOPT_FRESH_CONNECT, 1L) != CURLE_OK) return -1;
+	return 0;
+}
+
+static void destroyRequest(struct WebUpdater * updater, struct WebRequest * request) {
+	for (size_t i = 0; i < NELEMS(request->queries); i++) cancelDnsQuery(&updater->check, &request->queries[i]);
+	if (request->handle != NULL) {
+		if (request->active) curl_multi_remove_handle(updater->multi_handle, request->handle);
+		curl_easy_cleanup(request->handle);
+	}
+	free(request->url);
+}
+
+static void destroyTarget(struct WebUpdater * updater, struct WebTarget * target) {
+	for (size_t j = 0; j < target->n_requests; j++) {
+		destroyRequest(updater, target->requests[j]);
+		free(target->requests[j]);
+	}
+	free(target->requests);
+	destroyRequest(updater, &target->warmup);
+	destroyTemplate(&target->template);
+	free(target->source);
+	destroyTemplate(&target->check_template);
+	free(target->check_source);
+	free(target->check_name);
+	free(target);
+}
+
+static struct WebTarget * createTarget(struct WebUpdater * updater, char const * source, char const * check_name) {
+	struct WebTarget * target = calloc(1, sizeof(*target));
+	if (target == NULL) return NULL;
+	// The template points into its source
+	if ((target->source = strdup(source)) == NULL) goto cleanup;
+	if (parseTemplate(&target->template, target->source, updater->options.hostname) != 0) goto cleanup;
+	if (check_name != NULL) {
+		if ((target->check_source = strdup(check_name)) == NULL) goto cleanup;
+		if (parseTemplate(&target->check_template, target->check_source, updater->options.hostname) != 0) goto cleanup;
+		if ((target->check_name = malloc(target->check_template.max_len)) == NULL) goto cleanup;
+	}
+	target->state_key = stateKey(source);
+	target->tokens = updater->options.rate_burst;
+	target->url_len = target->template.max_len;
+	if (updater->options.preconnect && initWarmup(updater, target) != 0) goto cleanup;
+	return target;
+
+cleanup:
+	destroyTarget(updater, target);
+	return NULL;
+}
+
+Updater_t createWebUpdater(char const * const * templates, char const * const * check_names, size_t n_templates,
+                           int epoll_fd, struct Deadline * deadline, struct WebUpdaterOptions options) {
 	Updater_t data = malloc(sizeof(*data));
+	if (data == NULL) return NULL;
 	data->tag = WEB_UPDATER;
 	struct WebUpdater * updater = &data->web;
 	updater->multi_handle = NULL;
-	updater->handle = NULL;
-	updater->url = NULL;
-	updater->template = template;
-	updater->timeout = timeout;
+	updater->share = NULL;
+	updater->n_targets = 0;
+	updater->deadline = deadline;
 	updater->n_active = 0;
 	updater->epoll_fd = epoll_fd;
 	updater->options = options;
+	updater->curl_timer = false;
+	updater->state.entries = NULL;
+	updater->stats = (struct UpdaterStats) {0};
+	updater->check.fd = -1;
+	updater->check.active = NULL;
+	updater->check_data = NULL;
+	updater->n_latest = 0;
+	// Only used for jitter
+	srandom(getpid() ^ time(NULL));
+
+	if (loadState(&updater->state, options.state_path) != 0) goto cleanup;
+
+	if (options.check_server != NULL) {
+		if (createDnsCheck(&updater->check, options.check_server) != 0) goto cleanup;
+		if ((updater->check_data = malloc(sizeof(*updater->check_data))) == NULL) goto cleanup;
+		updater->check_data->tag = EPOLL_WEB_UPDATER;
+		updater->check_data->fd = updater->check.fd;
+		updater->check_data->web_updater = updater;
+		struct epoll_event ev = {
+			.events = EPOLLIN,
+			.data = { .ptr = updater->check_data },
+		};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, updater->check.fd, &ev) == -1) goto cleanup;
+	}
 
-	size_t url_len = strlen(template) + 1;
-	char const * tag_pos = template;
-	size_t tag_len = strlen(ip_tag);
-	while ((tag_pos = strstr(tag_pos, ip_tag)) != NULL) {
-		// Subtract the trailing NULL
-		url_len += INET6_ADDRSTRLEN - 1;
-		tag_pos += tag_len;
+	if ((updater->share = curl_share_init()) == NULL) goto cleanup;
+	if (curl_share_setopt(updater->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK
+	    || curl_share_setopt(updater->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK
+	    || curl_share_setopt(updater->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK) goto cleanup;
+
+	updater->targets = calloc(n_templates, sizeof(*updater->targets));
+	if (updater->targets == NULL) goto cleanup;
+	updater->n_targets = n_templates;
+	for (size_t i = 0; i < n_templates; i++) {
+		char const * check_name = check_names != NULL ? check_names[i] : NULL;
+		if ((updater->targets[i] = createTarget(updater, templates[i], check_name)) == NULL) goto cleanup;
+		updater->targets[i]->index = i;
 	}
-	updater->url = malloc(url_len);
-	if (updater->url == NULL) goto cleanup;
-	updater->url_len = url_len;
 
 	if ((updater->multi_handle = curl_multi_init()) == NULL) goto cleanup;
 	if (curl_multi_setopt(updater->multi_handle, CURLMOPT_SOCKETDATA, updater) != CURLM_OK) goto cleanup;
 	if (curl_multi_setopt(updater->multi_handle, CURLMOPT_SOCKETFUNCTION, socket_cb) != CURLM_OK) goto cleanup;
 	if (curl_multi_setopt(updater->multi_handle, CURLMOPT_TIMERDATA, updater) != CURLM_OK) goto cleanup;
 	if (curl_multi_setopt(updater->multi_handle, CURLMOPT_TIMERFUNCTION, timer_cb) != CURLM_OK) goto cleanup;
+	if (curl_multi_setopt(updater->multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX) != CURLM_OK) goto cleanup;
 
-	if ((updater->handle = curl_easy_init()) == NULL) goto cleanup;
+	// Have DNS, TCP and TLS done before the first update
+	if (prepareWebUpdater(updater) != 0) goto cleanup;
 	return data;
 
 cleanup:
@@ -150,50 +287,321 @@ cleanup:
 };
 
 void destroyWebUpdater(struct WebUpdater * updater) {
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		if (updater->targets[i] != NULL) destroyTarget(updater, updater->targets[i]);
+	}
+	free(updater->targets);
+	updater->targets = NULL;
+	updater->n_targets = 0;
 	if (updater->multi_handle != NULL) curl_multi_cleanup(updater->multi_handle);
 	updater->multi_handle = NULL;
-	if (updater->handle != NULL) curl_easy_cleanup(updater->handle);
-	updater->handle = NULL;
-	if (updater->url != NULL) free(updater->url);
-	updater->url = NULL;
+	// Once no handle uses it
+	if (updater->share != NULL) curl_share_cleanup(updater->share);
+	updater->share = NULL;
+	if (updater->check.fd >= 0) epoll_ctl(updater->epoll_fd, EPOLL_CTL_DEL, updater->check.fd, NULL);
+	destroyDnsCheck(&updater->check);
+	free(updater->check_data);
+	updater->check_data = NULL;
+	destroyState(&updater->state);
 };
 
-static int completeRequests(struct WebUpdater * updater, int fd, int events) {
-	int prev_active = updater->n_active;
-	if (curl_multi_socket_action(updater->multi_handle, fd, events, &updater->n_active) != CURLM_OK) return -1;
-	if (prev_active > updater->n_active) {
-		int nmsgs;
-		for (CURLMsg * msg = curl_multi_info_read(updater->multi_handle, &nmsgs);
-		     msg != NULL; msg = curl_multi_info_read(updater->multi_handle, &nmsgs)) {
-			if (msg->msg != CURLMSG_DONE) {
-				continue;
+static int startRequest(struct WebUpdater * updater, struct WebRequest * request) {
+	struct WebTarget const * target = request->target;
+	if (!renderTemplate(&target->template, &request->event, request->url, target->url_len)) return -1;
+	if (request->active) {
+		// Superseded by the new address
+		curl_multi_remove_handle(updater->multi_handle, request->handle);
+		request->active = false;
+	}
+	if (curl_easy_setopt(request->handle, CURLOPT_WRITEFUNCTION, updater->options.verbose ? print : discard) != CURLE_OK) return -1;
+	if (curl_easy_setopt(request->handle, CURLOPT_URL, request->url) != CURLE_OK) return -1;
+	if (curl_multi_add_handle(updater->multi_handle, request->handle) != CURLM_OK) return -1;
+	request->active = true;
+	PROBE(web__submit, request->event.ifindex, request->event.addr.af, &request->event.addr, request->url);
+	printf("Fetching address: %s\n", request->url);
+	return 0;
+}
+
+// Take one of the target's tokens, or say when the next one is due
+static bool takeToken(struct WebUpdater const * updater, struct WebTarget * target, struct timespec now,
+                      struct timespec * next) {
+	unsigned int const burst = updater->options.rate_burst;
+	unsigned int const interval = updater->options.rate_interval_ms;
+	if (burst == 0 || interval == 0) return true;
+
+	while (target->tokens < burst && !timespecBefore(now, target->refill_at)) {
+		target->tokens++;
+		target->refill_at = timespecAddMs(target->refill_at, interval);
+	}
+	if (target->tokens == 0) {
+		*next = target->refill_at;
+		return false;
+	}
+	// Refilling starts with the first token taken
+	if (target->tokens == burst) target->refill_at = timespecAddMs(now, interval);
+	target->tokens--;
+	return true;
+}
+
+// Start the request if its target's rate limit allows, otherwise hold it until it does
+static int dispatchRequest(struct WebUpdater * updater, struct WebRequest * request) {
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+	if (takeToken(updater, request->target, now, &request->start_at)) return startRequest(updater, request);
+
+	if (request->active) {
+		// Superseded by the held address
+		curl_multi_remove_handle(updater->multi_handle, request->handle);
+		request->active = false;
+	}
+	request->deferred = true;
+	updater->stats.throttled++;
+	printf("Rate limited, updating target %zu in %ld ms\n", request->target->index,
+	       timespecUntilMs(now, request->start_at));
+	return 0;
+}
+
+static bool retryable(CURLcode result, long status) {
+	switch (result) {
+	case CURLE_OK:
+		// Provider overloaded or throttling us
+		return status >= 500 || status == 429;
+	case CURLE_COULDNT_RESOLVE_HOST:
+		// DNS might not be available shortly after network comes up
+	case CURLE_COULDNT_CONNECT:
+	case CURLE_OPERATION_TIMEDOUT:
+	case CURLE_SEND_ERROR:
+	case CURLE_RECV_ERROR:
+	case CURLE_GOT_NOTHING:
+	case CURLE_SSL_CONNECT_ERROR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int scheduleRetry(struct WebUpdater * updater, struct WebRequest * request) {
+	if (request->attempts >= updater->options.max_retries) {
+		printf("Giving up on: %s\n", request->url);
+		updater->stats.failed++;
+		return 0;
+	}
+
+	// Exponential backoff, with jitter over the upper half so targets that
+	// failed together don't retry in lockstep
+	unsigned long long delay = updater->options.retry_base_ms;
+	for (unsigned int i = 0; i < request->attempts && delay < updater->options.retry_max_ms; i++) delay *= 2;
+	if (delay > updater->options.retry_max_ms) delay = updater->options.retry_max_ms;
+	delay = delay / 2 + random() % (delay / 2 + 1);
+	request->attempts++;
+	updater->stats.retried++;
+
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+	request->start_at = timespecAddMs(now, delay);
+	request->deferred = true;
+	printf("Retrying in %llu ms: %s\n", delay, request->url);
+	return 0;
+}
+
+// Addresses a request carries, all families if combined
+static struct IPAddr const * eventAddrs(struct AddrEvent const * event, struct IPAddr const ** addrs) {
+	if (!event->combined) {
+		addrs[0] = &event->addr;
+		return NULL;
+	}
+	addrs[0] = &event->ipv4;
+	return &event->ipv6;
+}
+
+static bool published(struct WebUpdater const * updater, struct WebTarget const * target,
+                      struct AddrEvent const * event) {
+	struct IPAddr const * addrs[2];
+	addrs[1] = eventAddrs(event, addrs);
+	for (size_t i = 0; i < NELEMS(addrs); i++) {
+		if (addrs[i] == NULL || addrs[i]->af == AF_UNSPEC) continue;
+		if (!statePublished(&updater->state, target->state_key, event->iface, event->netns_name, addrs[i])) return false;
+	}
+	return true;
+}
+
+static int storePublished(struct WebUpdater * updater, struct WebRequest const * request) {
+	struct IPAddr const * addrs[2];
+	addrs[1] = eventAddrs(&request->event, addrs);
+	for (size_t i = 0; i < NELEMS(addrs); i++) {
+		if (addrs[i] == NULL || addrs[i]->af == AF_UNSPEC) continue;
+		if (storeState(&updater->state, request->target->state_key, request->event.iface, request->event.netns_name,
+		               addrs[i]) != 0) return -1;
+	}
+	return 0;
+}
+
+// Ask the authoritative server first if the provider might have the address already, otherwise
+// send it straight away
+static int checkOrDispatch(struct WebUpdater * updater, struct WebRequest * request, bool unsure) {
+	struct WebTarget * target = request->target;
+	if (!unsure || updater->check.fd < 0 || target->check_source == NULL) return dispatchRequest(updater, request);
+
+	if (!renderTemplate(&target->check_template, &request->event, target->check_name, target->check_template.max_len)) {
+		return -1;
+	}
+	struct IPAddr const * addrs[2];
+	addrs[1] = eventAddrs(&request->event, addrs);
+	for (size_t i = 0; i < NELEMS(addrs); i++) {
+		if (addrs[i] == NULL || addrs[i]->af == AF_UNSPEC) continue;
+		struct DnsQuery * query = &request->queries[addrs[i]->af == AF_INET ? 0 : 1];
+		if (startDnsQuery(&updater->check, query, target->check_name, addrs[i]->af) != 0) return -1;
+	}
+	if (request->active) {
+		curl_multi_remove_handle(updater->multi_handle, request->handle);
+		request->active = false;
+	}
+	request->checking = true;
+	return 0;
+}
+
+// Settle requests whose record checks are done, sending those the record doesn't match
+static int resolveChecks(struct WebUpdater * updater, bool * dispatched) {
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		struct WebTarget * target = updater->targets[i];
+		for (size_t j = 0; j < target->n_requests; j++) {
+			struct WebRequest * request = target->requests[j];
+			if (!request->checking) continue;
+
+			struct IPAddr const * addrs[2];
+			addrs[1] = eventAddrs(&request->event, addrs);
+			bool pending = false, matches = true;
+			for (size_t k = 0; k < NELEMS(addrs); k++) {
+				if (addrs[k] == NULL || addrs[k]->af == AF_UNSPEC) continue;
+				struct DnsQuery const * query = &request->queries[addrs[k]->af == AF_INET ? 0 : 1];
+				enum DnsCheckResult result = dnsQueryResult(query, addrs[k]);
+				pending |= result == DNS_CHECK_PENDING;
+				// A failed check can't tell, so send anyway
+				matches &= result == DNS_CHECK_PUBLISHED;
 			}
-			CURL* e = msg->easy_handle;
-			CURLcode result = msg->data.result;
-			curl_multi_remove_handle(updater->multi_handle, e);
-			char * url = NULL;
-			curl_easy_getinfo(e, CURLINFO_EFFECTIVE_URL, &url);
-			if (result == CURLE_OK) {
-				if (url != NULL) printf("Fetched: %s\n", url);
-				return 0;
-			} else if (result == CURLE_COULDNT_RESOLVE_HOST) {
-				// TODO: DNS might not be available shortly after network comes up, so retry
-				return -1;
-			} else {
-				if (url != NULL) printf("Failed to fetch: %s\n", url);
-				return -1;
+			if (pending) continue;
+
+			request->checking = false;
+			if (matches) {
+				printf("Already in DNS, not updating target %zu\n", i);
+				updater->stats.succeeded++;
+				if (storePublished(updater, request) != 0) perror("Couldn't save state");
+				continue;
 			}
+			if (updater->options.verbose) printf("Not in DNS yet, updating target %zu\n", i);
+			if (dispatchRequest(updater, request) != 0) return -1;
+			*dispatched = true;
 		}
-		return 0;
 	}
 	return 0;
 }
 
+static int completeRequests(struct WebUpdater * updater, int fd, int events) {
+	if (curl_multi_socket_action(updater->multi_handle, fd, events, &updater->n_active) != CURLM_OK) return -1;
+
+	int nmsgs;
+	for (CURLMsg * msg = curl_multi_info_read(updater->multi_handle, &nmsgs);
+	     msg != NULL; msg = curl_multi_info_read(updater->multi_handle, &nmsgs)) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+		CURL* e = msg->easy_handle;
+		CURLcode result = msg->data.result;
+		curl_multi_remove_handle(updater->multi_handle, e);
+		struct WebRequest * request = NULL;
+		curl_easy_getinfo(e, CURLINFO_PRIVATE, &request);
+		if (request == NULL) continue;
+		request->active = false;
+		if (request->preconnect) {
+			if (updater->options.verbose) printf("Preconnected (%s): %s\n", curl_easy_strerror(result), request->url);
+			continue;
+		}
+
+		long status = 0;
+		curl_easy_getinfo(e, CURLINFO_RESPONSE_CODE, &status);
+		PROBE(web__complete, request->event.ifindex, request->event.addr.af, &request->event.addr, request->url,
+		      (int) result, status);
+		if (retryable(result, status)) {
+			printf("Failed to fetch (%s): %s\n",
+			       result == CURLE_OK ? "server error" : curl_easy_strerror(result), request->url);
+			if (scheduleRetry(updater, request) != 0) return -1;
+		} else if (result == CURLE_OK) {
+			printf("Fetched: %s\n", request->url);
+			updater->stats.succeeded++;
+			observeLatency(&updater->stats, request->event.received);
+			// Not fatal, the worst case is a redundant update after restarting
+			if (storePublished(updater, request) != 0) perror("Couldn't save state");
+		} else {
+			// Retrying won't help, wait for the next change
+			printf("Failed to fetch (%s): %s\n", curl_easy_strerror(result), request->url);
+			updater->stats.failed++;
+		}
+	}
+	return setDeadline(updater);
+}
+
 int handleWebTimeout(struct WebUpdater * updater) {
-	return completeRequests(updater, CURL_SOCKET_TIMEOUT, 0);
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) return -1;
+
+	bool retried = false;
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		struct WebTarget * target = updater->targets[i];
+		for (size_t j = 0; j < target->n_requests; j++) {
+			struct WebRequest * request = target->requests[j];
+			if (!request->deferred || timespecBefore(now, request->start_at)) continue;
+			request->deferred = false;
+			// The failed attempt may have gone through nonetheless
+			if (checkOrDispatch(updater, request, request->attempts > 0) != 0) return -1;
+			retried = true;
+		}
+	}
+	if (updater->check.fd >= 0) {
+		expireDnsCheck(&updater->check, now);
+		if (resolveChecks(updater, &retried) != 0) return -1;
+	}
+
+	if (retried || (updater->curl_timer && !timespecBefore(now, updater->curl_deadline))) {
+		updater->curl_timer = false;
+		return completeRequests(updater, CURL_SOCKET_TIMEOUT, 0);
+	}
+	return setDeadline(updater);
+}
+
+bool webUpdaterIdle(struct WebUpdater const * updater) {
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		struct WebTarget const * target = updater->targets[i];
+		for (size_t j = 0; j < target->n_requests; j++) {
+			if (requestBusy(target->requests[j])) return false;
+		}
+	}
+	return true;
+}
+
+static int startWarmup(struct WebUpdater * updater, struct WebTarget * target) {
+	struct WebRequest * request = &target->warmup;
+	if (!updater->options.preconnect || request->active) return 0;
+	if (curl_multi_add_handle(updater->multi_handle, request->handle) != CURLM_OK) return -1;
+	request->active = true;
+	if (updater->options.verbose) printf("Preconnecting: %s\n", request->url);
+	return 0;
+}
+
+int prepareWebUpdater(struct WebUpdater * updater) {
+	if (!updater->options.preconnect) return 0;
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		if (startWarmup(updater, updater->targets[i]) != 0) return -1;
+	}
+	if (curl_multi_socket_action(updater->multi_handle, CURL_SOCKET_TIMEOUT, 0, &updater->n_active) != CURLM_OK) return -1;
+	return setDeadline(updater);
 }
 
 int handleWebMessage(struct WebUpdater * updater, int fd, int32_t events) {
+	if (fd == updater->check.fd) {
+		bool dispatched = false;
+		if (receiveDnsCheck(&updater->check) != 0 || resolveChecks(updater, &dispatched) != 0) return -1;
+		return completeRequests(updater, CURL_SOCKET_TIMEOUT, 0);
+	}
 	if (events & EPOLLIN) {
 		events |= CURL_CSELECT_IN;
 	}
@@ -203,17 +611,154 @@ int handleWebMessage(struct WebUpdater * updater, int fd, int32_t events) {
 	return completeRequests(updater, fd, events);
 }
 
-int webUpdate(struct WebUpdater * updater, struct IPAddr const addr){
-	if (!templateUrl(addr, updater->template, updater->url, updater->url_len)) return -1;
-	if (updater->n_active > 0) {
-		curl_multi_remove_handle(updater->multi_handle, updater->handle);
+// The request for event's interface and family, created by its first change
+static struct WebRequest * findRequest(struct WebUpdater * updater, struct WebTarget * target,
+                                       struct AddrEvent const * event) {
+	for (size_t j = 0; j < target->n_requests; j++) {
+		if (sameRequest(&target->requests[j]->event, event)) return target->requests[j];
 	}
-	if (curl_easy_setopt(updater->handle, CURLOPT_WRITEFUNCTION, updater->options.verbose ? print : discard) != CURLE_OK) return -1;
-	if (curl_easy_setopt(updater->handle, CURLOPT_URL, updater->url) != CURLE_OK) return -1;
-	if (curl_multi_add_handle(updater->multi_handle, updater->handle) != CURLM_OK) return -1;
-	printf("Fetching address: %s\n", updater->url);
+	struct WebRequest ** requests = realloc(target->requests, (target->n_requests + 1) * sizeof(*requests));
+	if (requests == NULL) return NULL;
+	target->requests = requests;
+	struct WebRequest * request = calloc(1, sizeof(*request));
+	if (request == NULL) return NULL;
+	request->target = target;
+	request->event = *event;
+	if ((request->url = malloc(target->url_len)) == NULL || initHandle(updater, request) != 0) {
+		destroyRequest(updater, request);
+		free(request);
+		return NULL;
+	}
+	target->requests[target->n_requests++] = request;
+	return request;
+}
 
-	if (curl_multi_socket_action(updater->multi_handle, CURL_SOCKET_TIMEOUT, 0, &updater->n_active) != CURLM_OK) return -1;
+// Kept per interface and family, like requests
+static void storeLatest(struct WebUpdater * updater, struct AddrEvent const * event) {
+	for (size_t j = 0; j < updater->n_latest; j++) {
+		if (!sameRequest(&updater->latest[j], event)) continue;
+		updater->latest[j] = *event;
+		return;
+	}
+	// Only interfaces that are gone could fill it, and reconfiguring clears those out
+	if (updater->n_latest < NELEMS(updater->latest)) updater->latest[updater->n_latest++] = *event;
+}
 
+// unsure if the target may have the address from before
+static int sendEvent(struct WebUpdater * updater, struct WebTarget * target, struct AddrEvent const * event,
+                     bool unsure) {
+	struct WebRequest * request = findRequest(updater, target, event);
+	if (request == NULL) return -1;
+	if (!requestBusy(request) && published(updater, target, event)) {
+		if (updater->options.verbose) printf("Already published to target %zu\n", target->index);
+		return 0;
+	}
+	// A new address resets the retry budget, and replaces any held back
+	request->event = *event;
+	request->attempts = 0;
+	request->deferred = false;
+	request->checking = false;
+	if (checkOrDispatch(updater, request, unsure) != 0) return -1;
+	updater->stats.issued++;
 	return 0;
 }
+
+// Both NULL, or the same name
+static bool sameCheck(char const * a, char const * b) {
+	return a == NULL || b == NULL ? a == b : strcmp(a, b) == 0;
+}
+
+int reconfigureWebUpdater(struct WebUpdater * updater, char const * const * templates,
+                          char const * const * check_names, size_t n_templates, struct AddrFilter const * filter) {
+	int result = -1;
+	struct WebTarget ** targets = calloc(n_templates + 1, sizeof(*targets));
+	// Which current targets stay, and which of the new ones had to be created
+	bool * kept = calloc(updater->n_targets + 1, sizeof(*kept));
+	bool * created = calloc(n_templates + 1, sizeof(*created));
+	if (targets == NULL || kept == NULL || created == NULL) goto cleanup;
+
+	// Everything that can fail first, so a failure leaves the targets as they were
+	for (size_t i = 0; i < n_templates; i++) {
+		uint64_t const key = stateKey(templates[i]);
+		char const * check_name = check_names != NULL ? check_names[i] : NULL;
+		for (size_t j = 0; j < updater->n_targets && targets[i] == NULL; j++) {
+			struct WebTarget * target = updater->targets[j];
+			if (kept[j] || target->state_key != key || !sameCheck(target->check_source, check_name)) continue;
+			kept[j] = true;
+			targets[i] = target;
+		}
+		if (targets[i] != NULL) continue;
+		if ((targets[i] = createTarget(updater, templates[i], check_name)) == NULL) goto cleanup;
+		created[i] = true;
+	}
+
+	for (size_t j = 0; j < updater->n_targets; j++) {
+		if (kept[j]) continue;
+		printf("No longer updating URL %s\n", updater->targets[j]->source);
+		destroyTarget(updater, updater->targets[j]);
+	}
+	free(updater->targets);
+	updater->targets = targets;
+	updater->n_targets = n_templates;
+	targets = NULL;
+	// Interfaces and families no longer monitored are left to whatever the URLs had
+	size_t n_latest = 0;
+	for (size_t j = 0; j < updater->n_latest; j++) {
+		if (monitored(filter, &updater->latest[j])) updater->latest[n_latest++] = updater->latest[j];
+	}
+	updater->n_latest = n_latest;
+
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		struct WebTarget * target = updater->targets[i];
+		target->index = i;
+		// Their requests go once done with
+		size_t n_requests = 0;
+		for (size_t j = 0; j < target->n_requests; j++) {
+			struct WebRequest * request = target->requests[j];
+			if (requestBusy(request) || monitored(filter, &request->event)) {
+				target->requests[n_requests++] = request;
+				continue;
+			}
+			destroyRequest(updater, request);
+			free(request);
+		}
+		target->n_requests = n_requests;
+		if (!created[i]) continue;
+		printf("Updating URL %s with addresses.\n", target->source);
+		if (startWarmup(updater, target) != 0) goto cleanup;
+		// Brought up to date straight away, rather than at the next change
+		for (size_t j = 0; j < updater->n_latest; j++) {
+			if (sendEvent(updater, target, &updater->latest[j], true) != 0) goto cleanup;
+		}
+	}
+	bool dispatched = false;
+	if (updater->check.fd >= 0 && resolveChecks(updater, &dispatched) != 0) goto cleanup;
+	if (curl_multi_socket_action(updater->multi_handle, CURL_SOCKET_TIMEOUT, 0, &updater->n_active) != CURLM_OK) goto cleanup;
+	result = setDeadline(updater);
+
+cleanup:
+	// Still set if nothing was swapped in
+	for (size_t i = 0; targets != NULL && created != NULL && i < n_templates; i++) {
+		if (created[i]) destroyTarget(updater, targets[i]);
+	}
+	free(targets);
+	free(kept);
+	free(created);
+	return result;
+}
+
+int webUpdate(struct WebUpdater * updater, struct AddrEvent const * event){
+	storeLatest(updater, event);
+	for (size_t i = 0; i < updater->n_targets; i++) {
+		// Nothing published since starting, the provider may have it from before
+		if (sendEvent(updater, updater->targets[i], event, event->previous.af == AF_UNSPEC) != 0) return -1;
+	}
+	// A check may have failed to even start
+	bool dispatched = false;
+	if (updater->check.fd >= 0 && resolveChecks(updater, &dispatched) != 0) return -1;
+
+	// Kick off all targets at once, so they run concurrently
+	if (curl_multi_socket_action(updater->multi_handle, CURL_SOCKET_TIMEOUT, 0, &updater->n_active) != CURLM_OK) return -1;
+
+	return setDeadline(updater);
+}
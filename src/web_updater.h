@@ -4,33 +4,128 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include <time.h>
+
 #include <curl/curl.h>
+#include "dns_check.h"
+#include "filter.h"
 #include "ipaddr.h"
+#include "url_template.h"
+#include "state.h"
+#include "stats.h"
+#include "timespec.h"
 
 struct WebUpdaterOptions {
 	bool verbose;
+	// Substituted for <hostname> in URLs
+	char const * hostname;
+	// Failed requests are retried up to max_retries times, with the delay
+	// doubling from retry_base_ms up to retry_max_ms
+	unsigned int max_retries;
+	unsigned int retry_base_ms;
+	unsigned int retry_max_ms;
+	// Each target gets rate_burst requests at once, and another every rate_interval_ms.
+	// Updates beyond that are held, and only the newest is sent. 0 for no limit.
+	unsigned int rate_burst;
+	unsigned int rate_interval_ms;
+	// Connect to each target's host ahead of updates, at startup and when a change is settling
+	bool preconnect;
+	// Before sending an address the provider might already have, after a restart or a retry,
+	// look up the target's check name on its authoritative server check_server, NULL to always send
+	char const * check_server;
+	// Where to keep what each target was last sent, NULL to not persist it
+	char const * state_path;
+};
+
+// Requests per target and interface, one per address family so that a change of
+// one family doesn't cancel the update of the other
+#define WEB_REQUESTS 2
+
+struct WebRequest {
+	struct WebTarget * target;
+	CURL* handle;
+	bool active;
+	// Only warms up a connection, a HEAD request for / on the target's host
+	bool preconnect;
+
+	// Change being published, kept for retries
+	struct AddrEvent event;
+	unsigned int attempts;
+	// Waiting to start, for a retry or the target's rate limit
+	bool deferred;
+	struct timespec start_at;
+	// Waiting on the published record check, of each family
+	bool checking;
+	struct DnsQuery queries[2];
+
+	char* url;
+};
+
+struct WebTarget {
+	// URL with placeholders, as given
+	char * source;
+	struct UrlTemplate template;
+	size_t url_len;
+	// Record to look up before sending an address the provider might have, with <iface> and
+	// <hostname> placeholders, NULL to always send. Rendered into check_name.
+	char * check_source;
+	struct UrlTemplate check_template;
+	char * check_name;
+	// Key of this target in the state
+	uint64_t state_key;
+	// Token bucket, the next token is added at refill_at while not full
+	unsigned int tokens;
+	struct timespec refill_at;
+	// One per interface and family, created by the first change of each. Allocated one by
+	// one, as their handles point back at them.
+	struct WebRequest ** requests;
+	size_t n_requests;
+	struct WebRequest warmup;
+	// Position among the updater's targets, for messages
+	size_t index;
 };
 
 struct WebUpdater {
 	CURLM* multi_handle;
-	CURL* handle;
+	// DNS, TLS sessions and connections, shared by every request
+	CURLSH* share;
+	// Each request has its own easy handle, all driven by multi_handle. Targets are
+	// allocated one by one, so they stay put when others come and go.
+	struct WebTarget ** targets;
+	size_t n_targets;
+	// Last change of each interface and family, for targets added later
+	struct AddrEvent latest[FILTER_MAX_IFACES * WEB_REQUESTS];
+	size_t n_latest;
 	int n_active;
 	struct WebUpdaterOptions options;
+	struct State state;
+	struct UpdaterStats stats;
+	// fd is -1 without a check server
+	struct DnsCheck check;
+	struct EpollData * check_data;
 
 	int epoll_fd;
 
-	char const* template;
-	char* url;
-	size_t url_len;
-
-	int* timeout;
+	// Combined curl and retry deadline, exposed to the main loop through deadline
+	bool curl_timer;
+	struct timespec curl_deadline;
+	struct Deadline * deadline;
 };
 
 void destroyWebUpdater(struct WebUpdater * updater);
-int webUpdate(struct WebUpdater * updater, struct IPAddr addr);
+int webUpdate(struct WebUpdater * updater, struct AddrEvent const * event);
 int handleWebMessage(struct WebUpdater * updater, int fd, int32_t events);
 int handleWebTimeout(struct WebUpdater * updater);
+int prepareWebUpdater(struct WebUpdater * updater);
+bool webUpdaterIdle(struct WebUpdater const * updater);
+// Switch to the URLs in templates. Targets whose URL and check name are unchanged carry on as they were,
+// new ones are sent the latest addresses of interfaces still in filter, and connections stay pooled
+// throughout.
+int reconfigureWebUpdater(struct WebUpdater * updater, char const * const * templates,
+                          char const * const * check_names, size_t n_templates, struct AddrFilter const * filter);
 
 #include "updater.h"
 
-Updater_t createWebUpdater(char const * template, int epoll_fd, int * timeout, struct WebUpdaterOptions options);
+// check_names has each template's record to check, or NULL. It may itself be NULL for none.
+Updater_t createWebUpdater(char const * const * templates, char const * const * check_names, size_t n_templates,
+                           int epoll_fd, struct Deadline * deadline, struct WebUpdaterOptions options);